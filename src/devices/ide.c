@@ -50,6 +50,10 @@
 #define CMD_READ_SECTOR_RETRY 0x20  /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30 /* WRITE SECTOR with retries. */
 
+/* Most sectors one READ SECTOR or WRITE SECTOR command can
+   transfer; the sector count register is 8 bits wide. */
+#define MAX_MULTIPLE 256
+
 /* An ATA device. */
 struct ata_disk {
   char name[8];            /* Name, e.g. "hda". */
@@ -83,7 +87,7 @@ static void reset_channel(struct channel*);
 static bool check_device_type(struct ata_disk*);
 static void identify_ata_device(struct ata_disk*);
 
-static void select_sector(struct ata_disk*, block_sector_t);
+static void select_sectors(struct ata_disk*, block_sector_t, size_t cnt);
 static void issue_pio_command(struct channel*, uint8_t command);
 static void input_sector(struct channel*, void*);
 static void output_sector(struct channel*, const void*);
@@ -306,53 +310,98 @@ static char* descramble_ata_string(char* string, int size) {
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes, using one READ SECTOR command per MAX_MULTIPLE
+   sectors.  The disk interrupts once per sector, when the sector
+   is ready to be transferred.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
-static void ide_read(void* d_, block_sector_t sec_no, void* buffer) {
+static void ide_read_multiple(void* d_, block_sector_t sec_no, size_t cnt, void* buffer_) {
   struct ata_disk* d = d_;
   struct channel* c = d->channel;
+  uint8_t* buffer = buffer_;
+
   lock_acquire(&c->lock);
-  select_sector(d, sec_no);
-  issue_pio_command(c, CMD_READ_SECTOR_RETRY);
-  sema_down(&c->completion_wait);
-  if (!wait_while_busy(d))
-    PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no);
-  input_sector(c, buffer);
+  while (cnt > 0) {
+    size_t n = cnt < MAX_MULTIPLE ? cnt : MAX_MULTIPLE;
+    select_sectors(d, sec_no, n);
+    issue_pio_command(c, CMD_READ_SECTOR_RETRY);
+    for (size_t i = 0; i < n; i++) {
+      sema_down(&c->completion_wait);
+      if (!wait_while_busy(d))
+        PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no + i);
+      input_sector(c, buffer);
+      buffer += BLOCK_SECTOR_SIZE;
+    }
+    sec_no += n;
+    cnt -= n;
+  }
   lock_release(&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes,
+   using one WRITE SECTOR command per MAX_MULTIPLE sectors.
+   Returns after the disk has acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
-static void ide_write(void* d_, block_sector_t sec_no, const void* buffer) {
+static void ide_write_multiple(void* d_, block_sector_t sec_no, size_t cnt,
+                               const void* buffer_) {
   struct ata_disk* d = d_;
   struct channel* c = d->channel;
+  const uint8_t* buffer = buffer_;
+
   lock_acquire(&c->lock);
-  select_sector(d, sec_no);
-  issue_pio_command(c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy(d))
-    PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no);
-  output_sector(c, buffer);
-  sema_down(&c->completion_wait);
+  while (cnt > 0) {
+    size_t n = cnt < MAX_MULTIPLE ? cnt : MAX_MULTIPLE;
+    select_sectors(d, sec_no, n);
+    issue_pio_command(c, CMD_WRITE_SECTOR_RETRY);
+    for (size_t i = 0; i < n; i++) {
+      if (!wait_while_busy(d))
+        PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no + i);
+      output_sector(c, buffer);
+      sema_down(&c->completion_wait);
+      buffer += BLOCK_SECTOR_SIZE;
+    }
+    sec_no += n;
+    cnt -= n;
+  }
   lock_release(&c->lock);
 }
 
-static struct block_operations ide_operations = {ide_read, ide_write};
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void ide_read(void* d_, block_sector_t sec_no, void* buffer) {
+  ide_read_multiple(d_, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void ide_write(void* d_, block_sector_t sec_no, const void* buffer) {
+  ide_write_multiple(d_, sec_no, 1, buffer);
+}
+
+static struct block_operations ide_operations = {ide_read, ide_write, ide_read_multiple,
+                                                  ide_write_multiple};
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void select_sector(struct ata_disk* d, block_sector_t sec_no) {
+   writes SEC_NO and CNT to the disk's sector selection and sector
+   count registers.  (We use LBA mode.)  A count of
+   MAX_MULTIPLE is written as 0. */
+static void select_sectors(struct ata_disk* d, block_sector_t sec_no, size_t cnt) {
   struct channel* c = d->channel;
 
-  ASSERT(sec_no < (1UL << 28));
+  ASSERT(sec_no + cnt <= (1UL << 28));
+  ASSERT(cnt > 0 && cnt <= MAX_MULTIPLE);
 
   select_device_wait(d);
-  outb(reg_nsect(c), 1);
+  outb(reg_nsect(c), cnt);
   outb(reg_lbal(c), sec_no);
   outb(reg_lbam(c), sec_no >> 8);
   outb(reg_lbah(c), (sec_no >> 16));
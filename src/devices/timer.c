@@ -1,6 +1,7 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
@@ -24,6 +25,18 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* A thread waiting in timer_sema_down(). */
+struct timed_waiter {
+  int64_t wake;           /* Tick at which to give up. */
+  struct semaphore* sema; /* Semaphore being waited on. */
+  bool expired;           /* Woken by the timer? */
+  struct list_elem elem;  /* Element in timed_waiters. */
+};
+
+/* Threads in timer_sema_down(), in order of WAKE.
+   Protected by disabling interrupts. */
+static struct list timed_waiters;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops(unsigned loops);
 static void busy_wait(int64_t loops);
@@ -34,6 +47,7 @@ static void real_time_delay(int64_t num, int32_t denom);
    and registers the corresponding interrupt. */
 void timer_init(void) {
   pit_configure_channel(0, 2, TIMER_FREQ);
+  list_init(&timed_waiters);
   intr_register_ext(0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -83,6 +97,38 @@ void timer_sleep(int64_t ticks) {
     thread_yield();
 }
 
+static bool wakes_earlier(const struct list_elem* a_, const struct list_elem* b_,
+                          void* aux UNUSED) {
+  const struct timed_waiter* a = list_entry(a_, struct timed_waiter, elem);
+  const struct timed_waiter* b = list_entry(b_, struct timed_waiter, elem);
+
+  return a->wake < b->wake;
+}
+
+/* Downs SEMA, giving up after approximately TICKS timer ticks.
+   Returns true if SEMA was downed, false if the wait timed out.
+   Unlike timer_sleep(), the thread stays blocked until one or
+   the other happens.  Interrupts must be turned on. */
+bool timer_sema_down(struct semaphore* sema, int64_t ticks) {
+  struct timed_waiter w;
+  enum intr_level old_level;
+
+  ASSERT(intr_get_level() == INTR_ON);
+  if (sema_try_down(sema))
+    return true;
+
+  old_level = intr_disable();
+  w.wake = timer_ticks() + ticks;
+  w.sema = sema;
+  w.expired = false;
+  list_insert_ordered(&timed_waiters, &w.elem, wakes_earlier, NULL);
+  sema_down(sema);
+  if (!w.expired)
+    list_remove(&w.elem);
+  intr_set_level(old_level);
+  return !w.expired;
+}
+
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
    turned on. */
 void timer_msleep(int64_t ms) { real_time_sleep(ms, 1000); }
@@ -128,6 +174,14 @@ void timer_print_stats(void) { printf("Timer: %" PRId64 " ticks\n", timer_ticks(
 /* Timer interrupt handler. */
 static void timer_interrupt(struct intr_frame* args UNUSED) {
   ticks++;
+  while (!list_empty(&timed_waiters)) {
+    struct timed_waiter* w = list_entry(list_front(&timed_waiters), struct timed_waiter, elem);
+    if (w->wake > ticks)
+      break;
+    list_pop_front(&timed_waiters);
+    w->expired = true;
+    sema_up(w->sema);
+  }
   thread_tick();
 }
 
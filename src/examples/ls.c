@@ -6,7 +6,10 @@
 
    By default, only the name of each file is printed.  If "-l" is
    given as the first argument, the type, size, and inumber of
-   each file is also printed.  This won't work until project 4. */
+   each file is also printed.  This won't work until project 4.
+
+   Entries are read many at a time with getdents(), so only a
+   file's size takes a system call of its own. */
 
 #include <syscall.h>
 #include <stdio.h>
@@ -20,34 +23,39 @@ static bool list_dir(const char* dir, bool verbose) {
   }
 
   if (isdir(dir_fd)) {
-    char name[READDIR_MAX_LEN];
+    struct dirent entries[32];
+    int cnt;
 
     printf("%s", dir);
     if (verbose)
       printf(" (inumber %d)", inumber(dir_fd));
     printf(":\n");
 
-    while (readdir(dir_fd, name)) {
-      printf("%s", name);
-      if (verbose) {
-        char full_name[128];
-        int entry_fd;
-
-        snprintf(full_name, sizeof full_name, "%s/%s", dir, name);
-        entry_fd = open(full_name);
+    while ((cnt = getdents(dir_fd, entries, sizeof entries / sizeof *entries)) > 0) {
+      int i;
 
-        printf(": ");
-        if (entry_fd != -1) {
-          if (isdir(entry_fd))
+      for (i = 0; i < cnt; i++) {
+        printf("%s", entries[i].name);
+        if (verbose) {
+          printf(": ");
+          if (entries[i].is_dir)
             printf("directory");
-          else
-            printf("%d-byte file", filesize(entry_fd));
-          printf(", inumber %d", inumber(entry_fd));
-        } else
-          printf("open failed");
-        close(entry_fd);
+          else {
+            char full_name[128];
+            int entry_fd;
+
+            snprintf(full_name, sizeof full_name, "%s/%s", dir, entries[i].name);
+            entry_fd = open(full_name);
+            if (entry_fd != -1)
+              printf("%d-byte file", filesize(entry_fd));
+            else
+              printf("open failed");
+            close(entry_fd);
+          }
+          printf(", inumber %u", entries[i].inumber);
+        }
+        printf("\n");
       }
-      printf("\n");
     }
   } else
     printf("%s: not a directory\n", dir);
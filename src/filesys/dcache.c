@@ -0,0 +1,143 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the results of recent directory lookups, keyed by
+   the sector of the directory's inode and the name looked up, so
+   that resolving the same path again reads no directory
+   contents.  A name found missing is remembered too, as a
+   negative entry whose sector is 0, which no directory entry can
+   name because it holds the free map inode.
+
+   The directory code keeps the cache current: it records each
+   entry it adds or removes, and drops the entries of a directory
+   whose inode is removed before its sector can be reused.  When
+   the cache is full, the least recently used entry is replaced. */
+
+/* Number of entries in the cache. */
+#define DCACHE_SIZE 256
+
+struct dentry {
+  block_sector_t dir;         /* Sector of the directory's inode. */
+  char name[NAME_MAX + 1];    /* Name looked up in DIR. */
+  block_sector_t sector;      /* Inode sector NAME refers to, or 0. */
+  struct hash_elem hash_elem; /* Element in dentry_index. */
+  struct list_elem elem;      /* Element in dentry_lru or dentry_free. */
+};
+
+static struct hash dentry_index; /* Cached entries. */
+static struct list dentry_lru;   /* Cached entries, most recent at front. */
+static struct list dentry_free;  /* Unused entries. */
+static struct lock dcache_lock;  /* Protects the variables above. */
+
+static unsigned dentry_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct dentry* d = hash_entry(e, struct dentry, hash_elem);
+  return hash_string(d->name) ^ hash_int(d->dir);
+}
+
+static bool dentry_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  const struct dentry* d_a = hash_entry(a, struct dentry, hash_elem);
+  const struct dentry* d_b = hash_entry(b, struct dentry, hash_elem);
+  return d_a->dir != d_b->dir ? d_a->dir < d_b->dir : strcmp(d_a->name, d_b->name) < 0;
+}
+
+/* Initializes the directory entry cache. */
+void dcache_init(void) {
+  struct dentry* dentries = calloc(DCACHE_SIZE, sizeof *dentries);
+
+  list_init(&dentry_lru);
+  list_init(&dentry_free);
+  lock_init(&dcache_lock);
+  if (dentries == NULL || !hash_init(&dentry_index, dentry_hash, dentry_less, NULL))
+    PANIC("directory entry cache creation failed");
+  for (size_t i = 0; i < DCACHE_SIZE; i++)
+    list_push_back(&dentry_free, &dentries[i].elem);
+}
+
+/* Returns the cached entry for NAME in the directory whose inode
+   is in sector DIR, or a null pointer if there is none.  The
+   cache's lock must be held. */
+static struct dentry* find_dentry(block_sector_t dir, const char* name) {
+  struct dentry key;
+  struct hash_elem* e;
+
+  key.dir = dir;
+  strlcpy(key.name, name, sizeof key.name);
+  e = hash_find(&dentry_index, &key.hash_elem);
+  return e != NULL ? hash_entry(e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   If the cache knows the answer, stores the sector of NAME's
+   inode, or 0 if DIR has no entry NAME, into *SECTORP and
+   returns true.  Otherwise, returns false. */
+bool dcache_lookup(block_sector_t dir, const char* name, block_sector_t* sectorp) {
+  struct dentry* d = NULL;
+
+  if (strlen(name) > NAME_MAX)
+    return false;
+
+  lock_acquire(&dcache_lock);
+  d = find_dentry(dir, name);
+  if (d != NULL) {
+    list_remove(&d->elem);
+    list_push_front(&dentry_lru, &d->elem);
+    *sectorp = d->sector;
+  }
+  lock_release(&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector DIR
+   refers to the inode in SECTOR, or that DIR has no entry NAME if
+   SECTOR is 0. */
+void dcache_insert(block_sector_t dir, const char* name, block_sector_t sector) {
+  struct dentry* d;
+
+  if (strlen(name) > NAME_MAX)
+    return;
+
+  lock_acquire(&dcache_lock);
+  d = find_dentry(dir, name);
+  if (d != NULL) {
+    list_remove(&d->elem);
+  } else {
+    if (!list_empty(&dentry_free)) {
+      d = list_entry(list_pop_front(&dentry_free), struct dentry, elem);
+    } else {
+      d = list_entry(list_pop_back(&dentry_lru), struct dentry, elem);
+      hash_delete(&dentry_index, &d->hash_elem);
+    }
+    d->dir = dir;
+    strlcpy(d->name, name, sizeof d->name);
+    hash_insert(&dentry_index, &d->hash_elem);
+  }
+  d->sector = sector;
+  list_push_front(&dentry_lru, &d->elem);
+  lock_release(&dcache_lock);
+}
+
+/* Forgets every cached entry of the directory whose inode is in
+   sector DIR. */
+void dcache_invalidate_dir(block_sector_t dir) {
+  struct list_elem* e;
+
+  lock_acquire(&dcache_lock);
+  for (e = list_begin(&dentry_lru); e != list_end(&dentry_lru);) {
+    struct dentry* d = list_entry(e, struct dentry, elem);
+    e = list_next(e);
+    if (d->dir == dir) {
+      hash_delete(&dentry_index, &d->hash_elem);
+      list_remove(&d->elem);
+      list_push_back(&dentry_free, &d->elem);
+    }
+  }
+  lock_release(&dcache_lock);
+}
@@ -0,0 +1,12 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+void dcache_init(void);
+bool dcache_lookup(block_sector_t dir, const char* name, block_sector_t*);
+void dcache_insert(block_sector_t dir, const char* name, block_sector_t);
+void dcache_invalidate_dir(block_sector_t dir);
+
+#endif /* filesys/dcache.h */
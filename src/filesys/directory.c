@@ -1,17 +1,24 @@
 #include "filesys/directory.h"
+#include <dirent.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
 /* A directory. */
 
+static void maybe_compact(struct dir*);
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool dir_create(block_sector_t sector, size_t entry_cnt) {
-  return inode_create(sector, entry_cnt * sizeof(struct dir_entry));
+  return inode_create(sector, entry_cnt * sizeof(struct dir_entry), true);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -44,6 +51,7 @@ struct dir* dir_reopen(struct dir* dir) {
 /* Destroys DIR and frees associated resources. */
 void dir_close(struct dir* dir) {
   if (dir != NULL) {
+    maybe_compact(dir);
     inode_close(dir->inode);
     free(dir);
   }
@@ -54,43 +62,354 @@ struct inode* dir_get_inode(struct dir* dir) {
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
+/* Searches DIR, from byte offset START on, for a file with the
+   given NAME, if NAME is non-null, and for a free slot, if FREEP
+   is non-null, in a single pass.
+   If NAME is found, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
-static bool lookup(const struct dir* dir, const char* name, struct dir_entry* ep, off_t* ofsp) {
+   directory entry if OFSP is non-null.  Otherwise, returns false
+   and ignores EP and OFSP.
+   Unless NAME is found, sets *FREEP to the offset of the first
+   free slot, or to the end of the directory if there is none.
+
+   Entries are examined in place in the buffer cache, one sector
+   at a time; only entries that straddle two sectors are copied. */
+static bool lookup(const struct dir* dir, const char* name, off_t start, struct dir_entry* ep,
+                   off_t* ofsp, off_t* freep) {
+  struct buffer_cache_entry* block = NULL;
+  block_sector_t sector = 0;
+  off_t block_ofs = 0;
+  off_t length;
   struct dir_entry e;
-  size_t ofs;
+  off_t ofs;
+  off_t free_ofs = -1;
+  bool found = false;
 
   ASSERT(dir != NULL);
-  ASSERT(name != NULL);
 
-  for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
-    if (e.in_use && !strcmp(name, e.name)) {
+  length = inode_length(dir->inode);
+  for (ofs = start; ofs + (off_t)sizeof e <= length; ofs += sizeof e) {
+    const struct dir_entry* cur;
+    off_t sector_ofs = ofs % BLOCK_SECTOR_SIZE;
+
+    if (sector_ofs + sizeof e > BLOCK_SECTOR_SIZE) {
+      if (block != NULL) {
+        buffer_cache_put(block, sector, false);
+        block = NULL;
+      }
+      if (inode_read_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
+        break;
+      cur = &e;
+    } else {
+      if (block == NULL || block_ofs != ofs - sector_ofs) {
+        if (block != NULL)
+          buffer_cache_put(block, sector, false);
+        block_ofs = ofs - sector_ofs;
+        block = inode_get_block(dir->inode, block_ofs, false, &sector);
+        if (block == NULL && sector != 0)
+          break;
+      }
+      /* A hole reads as unused entries. */
+      if (block == NULL) {
+        memset(&e, 0, sizeof e);
+        cur = &e;
+      } else {
+        cur = (const struct dir_entry*)((const uint8_t*)buffer_cache_data(block, sector) +
+                                        sector_ofs);
+      }
+    }
+
+    if (!cur->in_use) {
+      if (free_ofs < 0)
+        free_ofs = ofs;
+      if (name == NULL)
+        break;
+    } else if (name != NULL && !strcmp(name, cur->name)) {
       if (ep != NULL)
-        *ep = e;
+        *ep = *cur;
       if (ofsp != NULL)
         *ofsp = ofs;
-      return true;
+      found = true;
+      break;
     }
-  return false;
+  }
+  if (block != NULL)
+    buffer_cache_put(block, sector, false);
+
+  if (freep != NULL)
+    *freep = free_ofs >= 0 ? free_ofs : ofs;
+  return found;
+}
+
+/* Hash index.
+
+   A directory that grows to INDEX_MIN_LENGTH bytes gets a hash
+   index, so that a name can be found without reading every
+   entry.  The index is a separate file whose inode sector is
+   recorded in the directory's inode.  The entries stay where
+   they are, so dir_readdir() works as before and directories
+   without an index are still searched linearly.
+
+   The index file is an array of one-sector buckets, each holding
+   the hash and offset of the entries whose names hash to it.  A
+   bucket never written is a hole and reads as empty.  When a
+   bucket fills, the index is rebuilt with twice as many buckets;
+   if that fails, the index is dropped.  An index is built within
+   a single journal operation, which bounds its number of buckets,
+   so the largest directories are searched linearly.
+
+   The index is changed only with the directory locked
+   exclusively, and searched only with it locked shared. */
+
+/* Directory length at which an index is built. */
+#define INDEX_MIN_LENGTH (4 * BLOCK_SECTOR_SIZE)
+
+/* Entries per bucket when an index is built, which leaves room
+   to grow before a bucket fills. */
+#define INDEX_LOAD 16
+
+/* Maximum number of buckets in an index.  Building one writes
+   every bucket, and must leave room in the journal operation for
+   the rest of the change that prompted it. */
+#define INDEX_MAX_BUCKETS (JOURNAL_OP_BLOCKS / 2)
+
+/* Number of entries a bucket can hold. */
+#define BUCKET_SLOTS 63
+
+/* One bucket of a directory's hash index.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct index_bucket {
+  uint32_t cnt; /* Number of slots in use. */
+  struct {
+    uint32_t hash; /* Hash of the entry's name. */
+    uint32_t ofs;  /* Byte offset of the entry in the directory. */
+  } slots[BUCKET_SLOTS];
+  uint32_t unused; /* Not used. */
+};
+
+/* Returns the byte offset in INDEX of the bucket for names that
+   hash to HASH. */
+static off_t bucket_ofs(struct inode* index, unsigned hash) {
+  size_t bucket_cnt = inode_length(index) / sizeof(struct index_bucket);
+  return hash % bucket_cnt * sizeof(struct index_bucket);
+}
+
+/* Adds the entry at OFS, whose name hashes to HASH, to INDEX.
+   Returns false if its bucket is full or on error. */
+static bool index_insert(struct inode* index, unsigned hash, off_t ofs) {
+  struct index_bucket* b = malloc(sizeof *b);
+  off_t pos = bucket_ofs(index, hash);
+  bool success = false;
+
+  if (b != NULL && inode_read_at(index, b, sizeof *b, pos) == sizeof *b && b->cnt < BUCKET_SLOTS) {
+    b->slots[b->cnt].hash = hash;
+    b->slots[b->cnt].ofs = ofs;
+    b->cnt++;
+    success = inode_write_at(index, b, sizeof *b, pos) == sizeof *b;
+  }
+  free(b);
+  return success;
+}
+
+/* Removes the entry at OFS, whose name hashes to HASH, from
+   INDEX.  Returns false on error. */
+static bool index_delete(struct inode* index, unsigned hash, off_t ofs) {
+  struct index_bucket* b = malloc(sizeof *b);
+  off_t pos = bucket_ofs(index, hash);
+  bool success = false;
+
+  if (b != NULL && inode_read_at(index, b, sizeof *b, pos) == sizeof *b) {
+    for (size_t i = 0; i < b->cnt; i++)
+      if (b->slots[i].ofs == (uint32_t)ofs) {
+        b->slots[i] = b->slots[--b->cnt];
+        break;
+      }
+    success = inode_write_at(index, b, sizeof *b, pos) == sizeof *b;
+  }
+  free(b);
+  return success;
+}
+
+/* Deletes the index file whose inode is in SECTOR. */
+static void free_index(block_sector_t sector) {
+  struct inode* index = inode_open(sector);
+  if (index != NULL) {
+    inode_remove(index);
+    inode_close(index);
+  }
+}
+
+/* Drops DIR's index, if any, leaving DIR to be searched
+   linearly. */
+static void drop_index(struct dir* dir) {
+  block_sector_t sector = inode_get_index(dir->inode);
+  if (sector != 0) {
+    inode_set_index(dir->inode, 0);
+    free_index(sector);
+  }
+}
+
+/* Builds an index of DIR's entries with BUCKET_CNT buckets and
+   makes it DIR's index in place of the old one, if any.
+   Returns false, leaving the old index alone, if a bucket
+   overflows or on error. */
+static bool build_index(struct dir* dir, size_t bucket_cnt) {
+  block_sector_t sector;
+  struct inode* index = NULL;
+  struct dir_entry e;
+  bool success;
+  off_t ofs;
+
+  ASSERT(sizeof(struct index_bucket) == BLOCK_SECTOR_SIZE);
+
+  if (bucket_cnt > INDEX_MAX_BUCKETS)
+    return false;
+  if (!free_map_allocate_inode(inode_get_inumber(dir->inode), false, &sector))
+    return false;
+  if (!inode_create(sector, bucket_cnt * sizeof(struct index_bucket), false) ||
+      (index = inode_open(sector)) == NULL) {
+    free_map_release(sector, 1);
+    return false;
+  }
+  inode_mark_index(index);
+
+  success = true;
+  for (ofs = 0; success && inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    if (e.in_use)
+      success = index_insert(index, hash_string(e.name), ofs);
+
+  if (success) {
+    block_sector_t old = inode_get_index(dir->inode);
+    inode_set_index(dir->inode, sector);
+    if (old != 0)
+      free_index(old);
+  } else {
+    inode_remove(index);
+  }
+  inode_close(index);
+  return success;
+}
+
+/* Returns the number of buckets for an index of DIR, enough for
+   INDEX_LOAD entries per bucket. */
+static size_t index_size(const struct dir* dir) {
+  size_t entry_cnt = inode_length(dir->inode) / sizeof(struct dir_entry);
+  size_t bucket_cnt;
+
+  for (bucket_cnt = 1; bucket_cnt * INDEX_LOAD < entry_cnt; bucket_cnt *= 2)
+    continue;
+  return bucket_cnt;
+}
+
+/* Adds the entry for NAME, just written at OFS, to DIR's index,
+   building the index if DIR has grown large enough. */
+static void index_add(struct dir* dir, const char* name, off_t ofs) {
+  block_sector_t sector = inode_get_index(dir->inode);
+  struct inode* index;
+  size_t bucket_cnt;
+  bool success;
+
+  if (sector == 0) {
+    if (inode_length(dir->inode) >= INDEX_MIN_LENGTH)
+      build_index(dir, index_size(dir));
+    return;
+  }
+
+  index = inode_open(sector);
+  if (index == NULL) {
+    drop_index(dir);
+    return;
+  }
+  success = index_insert(index, hash_string(name), ofs);
+  bucket_cnt = inode_length(index) / sizeof(struct index_bucket);
+  inode_close(index);
+
+  /* A full bucket calls for more buckets. */
+  while (!success && bucket_cnt < INDEX_MAX_BUCKETS) {
+    bucket_cnt *= 2;
+    success = build_index(dir, bucket_cnt);
+  }
+  if (!success)
+    drop_index(dir);
+}
+
+/* Removes the entry for NAME at OFS from DIR's index, if any. */
+static void index_remove(struct dir* dir, const char* name, off_t ofs) {
+  block_sector_t sector = inode_get_index(dir->inode);
+  struct inode* index;
+
+  if (sector == 0)
+    return;
+  index = inode_open(sector);
+  if (index == NULL || !index_delete(index, hash_string(name), ofs))
+    drop_index(dir);
+  inode_close(index);
+}
+
+/* Searches DIR for NAME, and for a free slot if FREEP is non-null,
+   as lookup() does, through DIR's index if it has one.  With an
+   index, the free slot is searched for from DIR's free-slot hint
+   on; without one, both are found in the same pass.  DIR must be
+   locked, exclusively if FREEP is non-null. */
+static bool lookup_name(const struct dir* dir, const char* name, struct dir_entry* ep,
+                        off_t* ofsp, off_t* freep) {
+  block_sector_t sector = inode_get_index(dir->inode);
+  struct inode* index = sector != 0 ? inode_open(sector) : NULL;
+  struct index_bucket* b = index != NULL ? malloc(sizeof *b) : NULL;
+  unsigned hash = hash_string(name);
+  bool found = false;
+
+  if (b == NULL || inode_read_at(index, b, sizeof *b, bucket_ofs(index, hash)) != sizeof *b) {
+    /* No index, or it cannot be read: search linearly. */
+    found = lookup(dir, name, 0, ep, ofsp, freep);
+  } else {
+    for (size_t i = 0; i < b->cnt && !found; i++) {
+      struct dir_entry e;
+      off_t ofs = b->slots[i].ofs;
+
+      if (b->slots[i].hash == hash && inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e &&
+          e.in_use && !strcmp(name, e.name)) {
+        if (ep != NULL)
+          *ep = e;
+        if (ofsp != NULL)
+          *ofsp = ofs;
+        found = true;
+      }
+    }
+    if (!found && freep != NULL)
+      lookup(dir, NULL, dir->inode->dir_free, NULL, NULL, freep);
+  }
+  free(b);
+  inode_close(index);
+  return found;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+
+   The answer is taken from the directory entry cache if it is
+   there, and otherwise added to it, unless DIR has been removed:
+   its entries are dropped from the cache when it is removed, and
+   must not come back before its sector is reused. */
 bool dir_lookup(const struct dir* dir, const char* name, struct inode** inode) {
+  block_sector_t dir_sector, sector;
   struct dir_entry e;
 
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
-  if (lookup(dir, name, &e, NULL))
-    *inode = inode_open(e.inode_sector);
-  else
-    *inode = NULL;
+  dir_sector = inode_get_inumber(dir->inode);
+  inode_lock_dir(dir->inode, true);
+  if (!dcache_lookup(dir_sector, name, &sector)) {
+    sector = lookup_name(dir, name, &e, NULL, NULL) ? e.inode_sector : 0;
+    if (!dir->inode->removed)
+      dcache_insert(dir_sector, name, sector);
+  }
+  *inode = sector != 0 ? inode_open(sector) : NULL;
+  inode_unlock_dir(dir->inode, true);
 
   return *inode != NULL;
 }
@@ -100,7 +419,10 @@ bool dir_lookup(const struct dir* dir, const char* name, struct inode** inode) {
    INODE_SECTOR.
    Returns true if successful, false on failure.
    Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   error occurs.
+
+   Every slot before DIR's free-slot hint is in use, so the search
+   for a free slot starts there. */
 bool dir_add(struct dir* dir, const char* name, block_sector_t inode_sector) {
   struct dir_entry e;
   off_t ofs;
@@ -113,70 +435,100 @@ bool dir_add(struct dir* dir, const char* name, block_sector_t inode_sector) {
   if (*name == '\0' || strlen(name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup(dir, name, NULL, NULL))
-    goto done;
-
-  /* Set OFS to offset of free slot.
+  /* Check that DIR has not been removed and that NAME is not in
+     use, and set OFS to the offset of the first free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
-    if (!e.in_use)
-      break;
+     current end-of-file. */
+  inode_lock_dir(dir->inode, false);
+  if (dir->inode->removed || lookup_name(dir, name, NULL, NULL, &ofs))
+    goto done;
 
   /* Write slot. */
   e.in_use = true;
   strlcpy(e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success) {
+    dir->inode->dir_free = ofs + sizeof e;
+    index_add(dir, name, ofs);
+    dcache_insert(inode_get_inumber(dir->inode), name, inode_sector);
+  }
 
 done:
+  inode_unlock_dir(dir->inode, false);
   return success;
 }
 
+/* Reads the next directory entry in DIR and stores the name in
+   NAME, as dir_readdir() does.  DIR must be locked. */
+static bool next_entry(struct dir* dir, char name[NAME_MAX + 1]) {
+  struct dir_entry e;
+
+  while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
+    dir->pos += sizeof e;
+    if (e.in_use) {
+      strlcpy(name, e.name, NAME_MAX + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs only if there is no file with the given NAME,
+   NAME is "." or "..", or NAME is a directory that is not empty.
+
+   DIR is locked, then the inode being removed, so that no entry
+   can be added to a directory once it has been found empty. */
 bool dir_remove(struct dir* dir, const char* name) {
   struct dir_entry e;
   struct inode* inode = NULL;
+  struct dir* temp = NULL;
   bool success = false;
   off_t ofs;
 
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
+  if (!strcmp(name, ".") || !strcmp(name, ".."))
+    return false;
+
   /* Find directory entry. */
-  if (!lookup(dir, name, &e, &ofs))
+  inode_lock_dir(dir->inode, false);
+  if (!lookup_name(dir, name, &e, &ofs, NULL))
     goto done;
 
   /* Open inode. */
   inode = inode_open(e.inode_sector);
-  struct dir* temp = malloc(sizeof(struct dir));
-  if (temp == NULL) {
-    return false;
-  }
+  temp = malloc(sizeof(struct dir));
+  if (inode == NULL || temp == NULL)
+    goto done;
+  inode_lock_dir(inode, false);
   temp->inode = inode;
   temp->pos = 2 * (sizeof(bool) + NAME_MAX + 1 + sizeof(block_sector_t));
   char n[NAME_MAX + 1];
-  if (inode == NULL || dir_readdir(temp, n)) {
-    goto done;
-  }
 
   /* Erase directory entry. */
   e.in_use = false;
-  if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
-    goto done;
+  if (!next_entry(temp, n) && inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e) {
+    if (ofs < dir->inode->dir_free)
+      dir->inode->dir_free = ofs;
+    dir->inode->dir_freed++;
+    index_remove(dir, name, ofs);
+    dcache_insert(inode_get_inumber(dir->inode), name, 0);
 
-  /* Remove inode. */
-  inode_remove(inode);
-  success = true;
+    /* Remove inode, and its index and cached entries if it is a
+       directory. */
+    inode_remove(inode);
+    drop_index(temp);
+    dcache_invalidate_dir(inode_get_inumber(inode));
+    success = true;
+  }
+  inode_unlock_dir(inode, false);
 
 done:
+  inode_unlock_dir(dir->inode, false);
   free(temp);
   inode_close(inode);
   return success;
@@ -186,14 +538,130 @@ done:
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
 bool dir_readdir(struct dir* dir, char name[NAME_MAX + 1]) {
+  bool success;
+
+  inode_lock_dir(dir->inode, true);
+  success = next_entry(dir, name);
+  inode_unlock_dir(dir->inode, true);
+  return success;
+}
+
+/* Number of entries dir_getdents() reads from DIR at a time. */
+#define GETDENTS_BATCH 25
+
+/* Reads entries from DIR, starting at its current position, into
+   the CNT elements of ENTRIES, as dir_readdir() would one at a
+   time, but reading GETDENTS_BATCH directory entries per inode
+   access.  Returns the number of elements filled, which is 0 at
+   the end of the directory. */
+size_t dir_getdents(struct dir* dir, struct dirent* entries, size_t cnt) {
+  struct dir_entry* batch = malloc(GETDENTS_BATCH * sizeof *batch);
+  size_t filled = 0;
+
+  if (batch == NULL)
+    return 0;
+  inode_lock_dir(dir->inode, true);
+  while (filled < cnt) {
+    off_t bytes = inode_read_at(dir->inode, batch, GETDENTS_BATCH * sizeof *batch, dir->pos);
+    size_t batch_cnt = bytes / sizeof *batch;
+    size_t i;
+
+    if (batch_cnt == 0)
+      break;
+    for (i = 0; i < batch_cnt && filled < cnt; i++)
+      if (batch[i].in_use) {
+        struct dirent* d = &entries[filled++];
+        struct inode* inode = inode_open(batch[i].inode_sector);
+
+        d->inumber = batch[i].inode_sector;
+        d->is_dir = inode != NULL && inode->data.dir;
+        strlcpy(d->name, batch[i].name, sizeof d->name);
+        inode_close(inode);
+      }
+    dir->pos += i * sizeof *batch;
+  }
+  inode_unlock_dir(dir->inode, true);
+  free(batch);
+  return filled;
+}
+
+/* Compaction.
+
+   Removing entries leaves free slots that every later scan of the
+   directory still reads.  Once a quarter of a directory's slots
+   have been freed since it was last compacted, closing it moves
+   the entries at its end into the free slots nearest its start
+   and truncates it after its last entry.
+
+   A reader part way through the directory would miss or repeat
+   the entries that move, so only the last opener compacts it.
+   Anyone who opens the directory meanwhile starts from its
+   beginning and must wait for the directory lock to read it.
+
+   Compaction may rewrite every sector of the directory and build
+   a new index in one journal operation, so directories longer
+   than COMPACT_MAX_LENGTH are left alone. */
+#define COMPACT_MAX_LENGTH ((JOURNAL_OP_BLOCKS - INDEX_MAX_BUCKETS - 4) * BLOCK_SECTOR_SIZE)
+
+/* Moves DIR's last entries into its first free slots, truncates
+   it, and rebuilds its index for the new offsets.  DIR must be
+   locked exclusively. */
+static void compact(struct dir* dir) {
+  struct inode* inode = dir->inode;
+  off_t length = inode_length(inode) / sizeof(struct dir_entry) * sizeof(struct dir_entry);
+  off_t lo = inode->dir_free;
+  off_t hi = length;
   struct dir_entry e;
 
-  while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
-    dir->pos += sizeof e;
-    if (e.in_use) {
-      strlcpy(name, e.name, NAME_MAX + 1);
-      return true;
+  while (lo < hi) {
+    /* Find the last entry in use, then the first free slot. */
+    off_t last = hi - sizeof e;
+    if (inode_read_at(inode, &e, sizeof e, last) != sizeof e)
+      break;
+    if (!e.in_use) {
+      hi = last;
+      continue;
     }
+    lookup(dir, NULL, lo, NULL, NULL, &lo);
+    if (lo >= last)
+      break;
+
+    /* Move the entry.  It is written to its new slot before it is
+       erased from its old one, so that it is never lost. */
+    if (inode_write_at(inode, &e, sizeof e, lo) != sizeof e)
+      break;
+    e.in_use = false;
+    if (inode_write_at(inode, &e, sizeof e, last) != sizeof e)
+      break;
+    hi = last;
+    lo += sizeof e;
   }
-  return false;
+
+  if (hi < length) {
+    inode_truncate(inode, hi);
+    if (inode_get_index(inode) != 0 &&
+        (hi < INDEX_MIN_LENGTH || !build_index(dir, index_size(dir))))
+      drop_index(dir);
+  }
+  inode->dir_free = lo < hi ? lo : hi;
+  inode->dir_freed = 0;
+}
+
+/* Compacts DIR, which is about to be closed, if enough of its
+   slots have been freed and no one else has it open. */
+static void maybe_compact(struct dir* dir) {
+  struct inode* inode = dir->inode;
+  size_t slot_cnt;
+
+  if (inode->dir_freed == 0 || inode->open_cnt != 1)
+    return;
+
+  journal_begin();
+  inode_lock_dir(inode, false);
+  slot_cnt = inode_length(inode) / sizeof(struct dir_entry);
+  if (inode->open_cnt == 1 && !inode->removed && inode_length(inode) > BLOCK_SECTOR_SIZE &&
+      inode_length(inode) <= COMPACT_MAX_LENGTH && inode->dir_freed * 4 >= slot_cnt)
+    compact(dir);
+  inode_unlock_dir(inode, false);
+  journal_end();
 }
@@ -24,6 +24,7 @@ struct dir_entry {
 };
 
 struct inode;
+struct dirent;
 
 /* Opening and closing directories. */
 bool dir_create(block_sector_t sector, size_t entry_cnt);
@@ -38,5 +39,6 @@ bool dir_lookup(const struct dir*, const char* name, struct inode**);
 bool dir_add(struct dir*, const char* name, block_sector_t);
 bool dir_remove(struct dir*, const char* name);
 bool dir_readdir(struct dir*, char name[NAME_MAX + 1]);
+size_t dir_getdents(struct dir*, struct dirent*, size_t cnt);
 
 #endif /* filesys/directory.h */
@@ -1,8 +1,21 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <stdint.h>
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window bounds, in sectors.  The window starts small
+   and doubles on every read that continues where the previous one
+   left off. */
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 64
+
+/* Most bytes written in one journal operation.  The sectors
+   written, which may be journaled, and the block pointers and
+   extents that change to map them must fit in JOURNAL_OP_BLOCKS. */
+#define WRITE_CHUNK (32 * BLOCK_SECTOR_SIZE)
+
 /* An open file. */
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -14,6 +27,8 @@ struct file* file_open(struct inode* inode) {
     file->inode = inode;
     file->pos = 0;
     file->deny_write = false;
+    file->ra_next = file->ra_end = 0;
+    file->ra_window = 0;
     return file;
   } else {
     inode_close(inode);
@@ -42,6 +57,36 @@ struct inode* file_get_inode(struct file* file) {
   return file->inode;
 }
 
+/* Updates FILE's sequential-access state after BYTES_READ bytes
+   were read starting at OFFSET.  A read that picks up where the
+   previous one ended grows the read-ahead window and queues the
+   sectors past what has already been requested; any other read
+   resets it. */
+static void readahead(struct file* file, off_t offset, off_t bytes_read) {
+  off_t end = offset + bytes_read;
+
+  if (bytes_read <= 0)
+    return;
+  if (offset != file->ra_next) {
+    file->ra_next = end;
+    file->ra_end = end;
+    file->ra_window = 0;
+    return;
+  }
+
+  if (file->ra_window == 0)
+    file->ra_window = READAHEAD_MIN;
+  else if (file->ra_window < READAHEAD_MAX)
+    file->ra_window *= 2;
+  file->ra_next = end;
+
+  off_t target = end + file->ra_window * BLOCK_SECTOR_SIZE;
+  off_t start = file->ra_end > end ? file->ra_end : end;
+  if (start < target)
+    inode_readahead(file->inode, start, target - start);
+  file->ra_end = target;
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
@@ -49,6 +94,7 @@ struct inode* file_get_inode(struct file* file) {
    Advances FILE's position by the number of bytes read. */
 off_t file_read(struct file* file, void* buffer, off_t size) {
   off_t bytes_read = inode_read_at(file->inode, buffer, size, file->pos);
+  readahead(file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -59,7 +105,30 @@ off_t file_read(struct file* file, void* buffer, off_t size) {
    which may be less than SIZE if end of file is reached.
    The file's current position is unaffected. */
 off_t file_read_at(struct file* file, void* buffer, off_t size, off_t file_ofs) {
-  return inode_read_at(file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at(file->inode, buffer, size, file_ofs);
+  readahead(file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE starting at OFS, as
+   one journal operation per WRITE_CHUNK bytes.  Returns the number
+   of bytes written. */
+static off_t write_chunked(struct inode* inode, const void* buffer_, off_t size, off_t ofs) {
+  const uint8_t* buffer = buffer_;
+  off_t written = 0;
+
+  while (written < size) {
+    off_t chunk = size - written < WRITE_CHUNK ? size - written : WRITE_CHUNK;
+    off_t n;
+
+    journal_begin();
+    n = inode_write_at(inode, buffer + written, chunk, ofs + written);
+    journal_end();
+    written += n;
+    if (n < chunk)
+      break;
+  }
+  return written;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -70,7 +139,7 @@ off_t file_read_at(struct file* file, void* buffer, off_t size, off_t file_ofs)
    not yet implemented.)
    Advances FILE's position by the number of bytes read. */
 off_t file_write(struct file* file, const void* buffer, off_t size) {
-  off_t bytes_written = inode_write_at(file->inode, buffer, size, file->pos);
+  off_t bytes_written = write_chunked(file->inode, buffer, size, file->pos);
   file->pos += bytes_written;
   return bytes_written;
 }
@@ -83,7 +152,7 @@ off_t file_write(struct file* file, const void* buffer, off_t size) {
    not yet implemented.)
    The file's current position is unaffected. */
 off_t file_write_at(struct file* file, const void* buffer, off_t size, off_t file_ofs) {
-  return inode_write_at(file->inode, buffer, size, file_ofs);
+  return write_chunked(file->inode, buffer, size, file_ofs);
 }
 
 /* Prevents write operations on FILE's underlying inode
@@ -9,6 +9,9 @@ struct file {
   struct inode* inode; /* File's inode. */
   off_t pos;           /* Current position. */
   bool deny_write;     /* Has file_deny_write() been called? */
+  off_t ra_next;       /* Offset at which a sequential read would continue. */
+  off_t ra_end;        /* Read-ahead has been issued up to this offset. */
+  off_t ra_window;     /* Current read-ahead window, in sectors. */
 };
 
 /* Opening and closing files. */
@@ -1,244 +1,1015 @@
 #include "filesys/filesys.h"
+#include <cache-stats.h>
 #include <debug.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <hash.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "devices/timer.h"
 #include "userprog/process.h"
+#include "userprog/syscall.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 
 /* Partition that contains the file system. */
 struct block* fs_device;
 
-struct list buffer_cache;
-struct lock buffer_cache_lock;
-struct buffer_cache_entry* clock_hand;
+#define BUFFER_CACHE_DEFAULT_SIZE 64 /* Default number of cached sectors. */
+#define BUFFER_CACHE_MIN_SIZE 64     /* Fewest sectors the cache may hold. */
+#define BUFFER_CACHE_SHARDS 8        /* Number of independently locked index shards. */
 
-int hit_count = 0;
-int miss_count = 0;
+/* The cache works in blocks of CACHE_BLOCK_SECTORS sectors, one
+   page each, aligned to a multiple of CACHE_BLOCK_SECTORS on the
+   device.  A miss fills the whole block with one device request.
+   Block data is carved out of slabs of contiguous kernel pages.
+   The first slab is allocated at boot; further slabs are added on
+   demand, up to the configured capacity. */
+#define SLAB_PAGES 8
+
+/* Cache entries live in a flat array so the clock hand can sweep
+   them in order.  The block index is split into shards, each a
+   hash table with its own lock, so lookups of unrelated blocks
+   do not contend.
+
+   Locking protocol:
+
+   - A shard's lock protects its index and the PIN_CNT of every
+     entry bound to one of its blocks.  It is only held for the
+     lookup itself.
+
+   - An entry has one rw_lock per sector, protecting that sector's
+     data and its bit in DIRTY.  Callers pin the entry under the
+     shard lock, drop the shard lock, and only then take the
+     sector's rw_lock, so copies in and out of the cache never
+     happen under an index lock.  Readers of the same sector share
+     it, and a thread holding one sector of a block may still use
+     the block's other sectors.  Nothing but a newly bound entry
+     ever holds more than one sector lock of a block at a time.
+
+   - evict_lock protects the clock hand and which block each
+     entry is bound to (SECTOR and VALID), plus PIN_CNT of entries
+     that are not bound to any block, the free list, the
+     replacement policy's state, ACTIVE_CNT and the slabs.  It is
+     acquired before any shard lock.
+
+   A pinned entry is never evicted or rebound. */
+static struct buffer_cache_entry* buffer_cache;
+static size_t buffer_cache_capacity = BUFFER_CACHE_DEFAULT_SIZE / CACHE_BLOCK_SECTORS; /* Max entries. */
+static size_t active_cnt; /* Entries backed by a slab. */
+static struct list free_entries; /* Active entries neither bound nor pinned. */
+static void** slabs;      /* Slab base addresses, SLAB_PAGES entries each. */
+static struct buffer_cache_shard {
+  struct lock lock;   /* Protects INDEX and the statistics below. */
+  struct hash index;  /* Maps blocks to entries. */
+
+  /* Statistics for accesses to the shard's blocks. */
+  unsigned hits[2], misses[2]; /* Indexed by enum cache_access. */
+  unsigned readahead_hits;
+  int64_t wait_ticks; /* Time spent waiting for sector locks. */
+} buffer_cache_shards[BUFFER_CACHE_SHARDS];
+static struct lock evict_lock;
+static unsigned evict_cnt; /* Blocks evicted, protected by evict_lock. */
+
+/* Write-behind.  A flusher thread writes dirty entries back in
+   sector order every FLUSH_INTERVAL ticks, and sooner once more
+   than DIRTY_RATIO percent of the active entries are dirty, so
+   eviction rarely has to write anything itself. */
+#define FLUSH_INTERVAL_DEFAULT TIMER_FREQ /* One second. */
+#define DIRTY_RATIO_DEFAULT 50
+static int64_t flush_interval = FLUSH_INTERVAL_DEFAULT;
+static int dirty_ratio = DIRTY_RATIO_DEFAULT;
+static struct lock dirty_lock; /* Protects the counts below and setting/clearing DIRTY. */
+static size_t dirty_cnt;       /* Number of dirty entries. */
+static unsigned dirty_sector_cnt; /* Number of dirty sectors. */
+static unsigned writeback_cnt;    /* Sectors written back since stats were reset. */
+static bool flush_requested;   /* Flusher woken early?  Under dirty_lock. */
+static struct semaphore flush_wakeup; /* Upped to wake the flusher early. */
+static struct lock flush_lock; /* Serializes flush passes; protects the rest. */
+static struct buffer_cache_entry** flush_batch;
+
+/* A flush pass gathers runs of consecutive dirty sectors, across
+   block boundaries, into FLUSH_BUFFER and writes each run with a
+   single request of up to FLUSH_RUN_SECTORS sectors. */
+#define FLUSH_RUN_PAGES 8
+#define FLUSH_RUN_SECTORS (FLUSH_RUN_PAGES * CACHE_BLOCK_SECTORS)
+static uint8_t* flush_buffer;
+static block_sector_t run_start; /* First sector of the run in FLUSH_BUFFER. */
+static size_t run_cnt;           /* Number of sectors in FLUSH_BUFFER. */
+
+/* Read-ahead.  Sectors queued by buffer_cache_prefetch() are
+   loaded by a worker thread so the requester does not wait. */
+#define READAHEAD_QUEUE_SIZE 128
+static block_sector_t readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_head, readahead_cnt; /* Protected by readahead_lock. */
+static struct lock readahead_lock;
+static struct semaphore readahead_pending; /* Number of queued sectors. */
 
 static void do_format(void);
 
-void buffer_cache_init(void) {
-  list_init(&buffer_cache);
-  lock_init(&buffer_cache_lock);
-  lock_acquire(&buffer_cache_lock);
+/* Returns the first sector of the cache block containing SECTOR. */
+static block_sector_t block_of(block_sector_t sector) {
+  return sector - sector % CACHE_BLOCK_SECTORS;
+}
 
-  struct buffer_cache_entry* entry;
-  for (int i = 0; i < 64; i++) {
-    entry = malloc(sizeof(struct buffer_cache_entry));
-    if (entry == NULL)
-      PANIC("Failed to malloc buffer cache entry");
-    entry->data = malloc(BLOCK_SECTOR_SIZE);
-    if (entry->data == NULL)
-      PANIC("Failed to malloc buffer cache entry data");
+/* Returns the index shard responsible for the cache block that
+   starts at BLOCK. */
+static struct buffer_cache_shard* shard_of(block_sector_t block) {
+  return &buffer_cache_shards[block / CACHE_BLOCK_SECTORS % BUFFER_CACHE_SHARDS];
+}
+
+/* Returns the number of sectors of the block cached in ENTRY that
+   exist on the device; the last block may be cut short. */
+static size_t block_sector_cnt(const struct buffer_cache_entry* entry) {
+  block_sector_t left = block_size(fs_device) - entry->sector;
+  return left < CACHE_BLOCK_SECTORS ? left : CACHE_BLOCK_SECTORS;
+}
+
+/* Returns a hash value for the sector cached in entry E. */
+static unsigned buffer_cache_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct buffer_cache_entry* entry = hash_entry(e, struct buffer_cache_entry, hash_elem);
+  return hash_int(entry->sector);
+}
+
+/* Returns true if entry A caches a lower block than entry B. */
+static bool buffer_cache_less(const struct hash_elem* a, const struct hash_elem* b,
+                              void* aux UNUSED) {
+  const struct buffer_cache_entry* entry_a = hash_entry(a, struct buffer_cache_entry, hash_elem);
+  const struct buffer_cache_entry* entry_b = hash_entry(b, struct buffer_cache_entry, hash_elem);
+  return entry_a->sector < entry_b->sector;
+}
+
+/* Sets the buffer cache to hold at most SECTORS sectors, rounded
+   up to whole blocks.  Must be called before buffer_cache_init(). */
+void buffer_cache_configure(size_t sectors) {
+  if (sectors < BUFFER_CACHE_MIN_SIZE)
+    sectors = BUFFER_CACHE_MIN_SIZE;
+  buffer_cache_capacity = DIV_ROUND_UP(sectors, CACHE_BLOCK_SECTORS);
+}
+
+/* Replacement policies.
+
+   A policy orders the bound entries for eviction.  pick_victim()
+   asks it for candidates one at a time and handles pinning,
+   dirtiness and the accessed bit itself, reporting back through
+   the hooks below.  Every hook is called with evict_lock held. */
+struct cache_policy {
+  const char* name;
+  void (*init)(void);
+  /* ENTRY has just been bound to its sector. */
+  void (*insert)(struct buffer_cache_entry* entry);
+  /* Returns the next entry to consider for eviction, or a null
+     pointer if there is none.  May return unbound entries, which
+     are skipped. */
+  struct buffer_cache_entry* (*candidate)(void);
+  /* Candidate ENTRY had its accessed bit set, which pick_victim()
+     has cleared. */
+  void (*touch)(struct buffer_cache_entry* entry);
+  /* Candidate ENTRY cannot be evicted right now. */
+  void (*skip)(struct buffer_cache_entry* entry);
+  /* ENTRY is being unbound.  EVICTED is false if it is merely
+     being invalidated. */
+  void (*remove)(struct buffer_cache_entry* entry, bool evicted);
+};
+
+/* Clock (second chance): sweeps the entry array in order. */
+static size_t clock_hand;
+
+static void clock_init(void) { clock_hand = 0; }
+
+static void clock_nop(struct buffer_cache_entry* entry UNUSED) {}
+
+static void clock_remove(struct buffer_cache_entry* entry UNUSED, bool evicted UNUSED) {}
+
+static struct buffer_cache_entry* clock_candidate(void) {
+  clock_hand %= active_cnt;
+  return &buffer_cache[clock_hand++];
+}
+
+static const struct cache_policy clock_policy = {
+    "clock", clock_init, clock_nop, clock_candidate, clock_nop, clock_nop, clock_remove,
+};
+
+/* 2Q (Johnson and Shasha).  Newly loaded sectors enter the A1in
+   FIFO.  When they fall out of it, only their sector numbers are
+   remembered in the A1out ghost queue.  A sector that is loaded
+   again while still in A1out has proven it is reused and goes to
+   the Am queue, which is managed as LRU (approximated with the
+   accessed bit).  A1in is kept to about a quarter of the cache,
+   so a long sequential scan churns through A1in without pushing
+   hot entries out of Am.  Ghosts cost a few bytes each, so A1out
+   remembers twice as many blocks as the cache holds, which lets
+   reuse be recognised across scans larger than the cache. */
+enum { QUEUE_NONE, QUEUE_A1IN, QUEUE_AM };
+
+struct ghost {
+  block_sector_t sector;      /* First sector of a recently evicted block. */
+  struct hash_elem hash_elem; /* Element in ghost_index. */
+  struct list_elem elem;      /* Element in ghost_fifo or ghost_free. */
+};
+
+static struct list a1in, am;            /* Entries, most recent at front. */
+static size_t a1in_cnt;                 /* Number of entries in A1IN. */
+static struct list ghost_fifo;          /* A1out, most recent at front. */
+static struct list ghost_free;          /* Unused ghosts. */
+static struct hash ghost_index;         /* Blocks in ghost_fifo. */
+
+static unsigned ghost_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_int(hash_entry(e, struct ghost, hash_elem)->sector);
+}
+
+static bool ghost_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  return hash_entry(a, struct ghost, hash_elem)->sector <
+         hash_entry(b, struct ghost, hash_elem)->sector;
+}
+
+static void twoq_init(void) {
+  size_t ghost_cnt = buffer_cache_capacity * 2;
+  struct ghost* ghosts = calloc(ghost_cnt, sizeof *ghosts);
+
+  list_init(&a1in);
+  list_init(&am);
+  a1in_cnt = 0;
+  list_init(&ghost_fifo);
+  list_init(&ghost_free);
+  if (ghosts == NULL || !hash_init(&ghost_index, ghost_hash, ghost_less, NULL))
+    PANIC("Failed to allocate 2Q ghost queue");
+  for (size_t i = 0; i < ghost_cnt; i++)
+    list_push_back(&ghost_free, &ghosts[i].elem);
+}
+
+static void twoq_insert(struct buffer_cache_entry* entry) {
+  struct ghost key;
+  struct hash_elem* e;
+
+  key.sector = entry->sector;
+  e = hash_delete(&ghost_index, &key.hash_elem);
+  if (e != NULL) {
+    struct ghost* g = hash_entry(e, struct ghost, hash_elem);
+    list_remove(&g->elem);
+    list_push_back(&ghost_free, &g->elem);
+    entry->queue = QUEUE_AM;
+    list_push_front(&am, &entry->elem);
+  } else {
+    entry->queue = QUEUE_A1IN;
+    list_push_front(&a1in, &entry->elem);
+    a1in_cnt++;
+  }
+}
+
+static struct buffer_cache_entry* twoq_candidate(void) {
+  if (!list_empty(&a1in) && (a1in_cnt > active_cnt / 4 || list_empty(&am)))
+    return list_entry(list_back(&a1in), struct buffer_cache_entry, elem);
+  if (!list_empty(&am))
+    return list_entry(list_back(&am), struct buffer_cache_entry, elem);
+  return NULL;
+}
+
+/* Hits while in A1in are treated as correlated and do not earn
+   another trip through the queue; hits in Am refresh the entry. */
+static void twoq_touch(struct buffer_cache_entry* entry) {
+  if (entry->queue == QUEUE_AM) {
+    list_remove(&entry->elem);
+    list_push_front(&am, &entry->elem);
+  }
+}
+
+static void twoq_skip(struct buffer_cache_entry* entry) {
+  list_remove(&entry->elem);
+  list_push_front(entry->queue == QUEUE_AM ? &am : &a1in, &entry->elem);
+}
+
+static void twoq_remove(struct buffer_cache_entry* entry, bool evicted) {
+  list_remove(&entry->elem);
+  if (entry->queue == QUEUE_A1IN) {
+    a1in_cnt--;
+    if (evicted) {
+      struct ghost* g;
+      if (!list_empty(&ghost_free)) {
+        g = list_entry(list_pop_front(&ghost_free), struct ghost, elem);
+      } else {
+        g = list_entry(list_pop_back(&ghost_fifo), struct ghost, elem);
+        hash_delete(&ghost_index, &g->hash_elem);
+      }
+      g->sector = entry->sector;
+      hash_insert(&ghost_index, &g->hash_elem);
+      list_push_front(&ghost_fifo, &g->elem);
+    }
+  }
+  entry->queue = QUEUE_NONE;
+}
+
+static const struct cache_policy twoq_policy = {
+    "2q", twoq_init, twoq_insert, twoq_candidate, twoq_touch, twoq_skip, twoq_remove,
+};
+
+static const struct cache_policy* policies[] = {&clock_policy, &twoq_policy};
+static const struct cache_policy* policy = &clock_policy;
+
+/* Selects the replacement policy named NAME ("clock" or "2q").
+   Returns false if there is no such policy.  Must be called
+   before buffer_cache_init(). */
+bool buffer_cache_set_policy(const char* name) {
+  for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+    if (!strcmp(name, policies[i]->name)) {
+      policy = policies[i];
+      return true;
+    }
+  return false;
+}
+
+/* Makes the flusher write back dirty entries every MS
+   milliseconds. */
+void buffer_cache_set_flush_interval(int ms) {
+  flush_interval = (int64_t)ms * TIMER_FREQ / 1000;
+  if (flush_interval < 1)
+    flush_interval = 1;
+}
+
+/* Makes writers wake the flusher early once more than PCT percent
+   of the cache is dirty. */
+void buffer_cache_set_dirty_ratio(int pct) {
+  dirty_ratio = pct < 0 ? 0 : pct > 100 ? 100 : pct;
+}
+
+/* Returns the number of pages, and so entries, in slab I. */
+static size_t slab_pages(size_t i) {
+  size_t pages = buffer_cache_capacity - i * SLAB_PAGES;
+  return pages < SLAB_PAGES ? pages : SLAB_PAGES;
+}
+
+/* Allocates the next slab and makes its entries available.
+   Returns false if the cache is at capacity or memory is short.
+   evict_lock must be held, except during initialization. */
+static bool grow_cache(void) {
+  size_t i = active_cnt / SLAB_PAGES;
+  size_t cnt;
+
+  if (active_cnt >= buffer_cache_capacity)
+    return false;
+  cnt = slab_pages(i);
+  slabs[i] = palloc_get_multiple(0, cnt);
+  if (slabs[i] == NULL)
+    return false;
+
+  for (size_t j = 0; j < cnt; j++) {
+    struct buffer_cache_entry* entry = &buffer_cache[active_cnt + j];
+    entry->data = (uint8_t*)slabs[i] + j * PGSIZE;
     entry->sector = -1;
-    entry->dirty = false;
+    entry->dirty = 0;
     entry->accessed = false;
+    entry->prefetched = false;
     entry->valid = false;
-    lock_init(&entry->lock);
-    list_push_back(&buffer_cache, &entry->elem);
+    entry->pin_cnt = 0;
+    entry->queue = QUEUE_NONE;
+    for (size_t k = 0; k < CACHE_BLOCK_SECTORS; k++) {
+      entry->exclusive[k] = false;
+      rw_lock_init(&entry->locks[k]);
+    }
+    list_push_back(&free_entries, &entry->elem);
   }
+  active_cnt += cnt;
+  return true;
+}
 
-  clock_hand = list_entry(list_begin(&buffer_cache), struct buffer_cache_entry, elem);
-  lock_release(&buffer_cache_lock);
+/* Frees trailing slabs, other than the first, whose entries are
+   all free.  evict_lock must be held. */
+static void shrink_cache(void) {
+  while (active_cnt > SLAB_PAGES) {
+    size_t i = (active_cnt - 1) / SLAB_PAGES;
+    size_t first = i * SLAB_PAGES;
+    for (size_t j = first; j < active_cnt; j++)
+      if (buffer_cache[j].valid || buffer_cache[j].pin_cnt > 0)
+        return;
+    for (size_t j = first; j < active_cnt; j++)
+      list_remove(&buffer_cache[j].elem);
+    palloc_free_multiple(slabs[i], slab_pages(i));
+    slabs[i] = NULL;
+    active_cnt = first;
+  }
 }
 
-struct buffer_cache_entry* find_buffer_cache_entry(block_sector_t sector) {
-  struct list_elem* e;
-  struct buffer_cache_entry* entry;
+void buffer_cache_init(void) {
+  for (int i = 0; i < BUFFER_CACHE_SHARDS; i++) {
+    struct buffer_cache_shard* shard = &buffer_cache_shards[i];
+    lock_init(&shard->lock);
+    if (!hash_init(&shard->index, buffer_cache_hash, buffer_cache_less, NULL))
+      PANIC("Failed to create buffer cache index");
+  }
+  lock_init(&evict_lock);
+  lock_init(&dirty_lock);
+  lock_init(&flush_lock);
+  sema_init(&flush_wakeup, 0);
+  lock_init(&readahead_lock);
+  sema_init(&readahead_pending, 0);
 
-  for (e = list_begin(&buffer_cache); e != list_end(&buffer_cache); e = list_next(e)) {
-    entry = list_entry(e, struct buffer_cache_entry, elem);
-    if (entry->sector == sector && entry->valid) {
-      return entry;
-    }
+  ASSERT(CACHE_BLOCK_SECTORS * BLOCK_SECTOR_SIZE == PGSIZE);
+  buffer_cache = calloc(buffer_cache_capacity, sizeof *buffer_cache);
+  slabs = calloc(DIV_ROUND_UP(buffer_cache_capacity, SLAB_PAGES), sizeof *slabs);
+  flush_batch = calloc(buffer_cache_capacity, sizeof *flush_batch);
+  flush_buffer = palloc_get_multiple(0, FLUSH_RUN_PAGES);
+  if (buffer_cache == NULL || slabs == NULL || flush_batch == NULL || flush_buffer == NULL)
+    PANIC("Failed to allocate buffer cache entries");
+
+  list_init(&free_entries);
+  active_cnt = dirty_cnt = 0;
+  if (!grow_cache())
+    PANIC("Failed to allocate buffer cache data");
+  policy->init();
+}
+
+/* Returns the entry bound to the block starting at BLOCK in
+   SHARD, or a null pointer if the block is not cached.  SHARD's
+   lock must be held. */
+static struct buffer_cache_entry* find_entry(struct buffer_cache_shard* shard,
+                                             block_sector_t block) {
+  struct buffer_cache_entry key;
+  struct hash_elem* e;
+
+  key.sector = block;
+  e = hash_find(&shard->index, &key.hash_elem);
+  return e != NULL ? hash_entry(e, struct buffer_cache_entry, hash_elem) : NULL;
+}
+
+/* Drops one pin on ENTRY, which must be bound to a block. */
+static void unpin_entry(struct buffer_cache_entry* entry) {
+  struct buffer_cache_shard* shard = shard_of(entry->sector);
+
+  lock_acquire(&shard->lock);
+  ASSERT(entry->pin_cnt > 0);
+  entry->pin_cnt--;
+  lock_release(&shard->lock);
+}
+
+/* Wakes the flusher before its interval ends, unless it has been
+   woken already.  The caller must hold dirty_lock. */
+static void request_flush(void) {
+  if (!flush_requested) {
+    flush_requested = true;
+    sema_up(&flush_wakeup);
   }
-  return NULL;
 }
 
-struct buffer_cache_entry* load_new_entry(block_sector_t sector) {
-  struct buffer_cache_entry* entry;
-  struct list_elem* e;
-
-  for (e = list_begin(&buffer_cache); e != list_end(&buffer_cache); e = list_next(e)) {
-    entry = list_entry(e, struct buffer_cache_entry, elem);
-    if (!entry->valid) {
-      entry->sector = sector;
-      entry->valid = true;
-      entry->dirty = false;
-      entry->accessed = true;
-      lock_release(&buffer_cache_lock);
-      block_read(fs_device, sector, entry->data);
-      lock_acquire(&buffer_cache_lock);
-      return entry;
+/* Marks sector IDX of ENTRY dirty.  The caller must hold that
+   sector's lock for writing.  Wakes the flusher if too much of the
+   cache is dirty. */
+static void mark_dirty(struct buffer_cache_entry* entry, size_t idx) {
+  lock_acquire(&dirty_lock);
+  if (!entry->dirty) {
+    dirty_cnt++;
+    if (dirty_cnt * 100 > active_cnt * dirty_ratio)
+      request_flush();
+  }
+  if (!(entry->dirty & (1 << idx))) {
+    entry->dirty |= 1 << idx;
+    dirty_sector_cnt++;
+  }
+  lock_release(&dirty_lock);
+}
+
+/* Marks sector IDX of ENTRY clean because it is being written
+   back, if WRITTEN, or because the journal has taken it over.
+   The caller must hold that sector's lock. */
+static void clear_dirty(struct buffer_cache_entry* entry, size_t idx, bool written) {
+  lock_acquire(&dirty_lock);
+  if (entry->dirty & (1 << idx)) {
+    entry->dirty &= ~(1 << idx);
+    if (!entry->dirty)
+      dirty_cnt--;
+    dirty_sector_cnt--;
+    if (written)
+      writeback_cnt++;
+  }
+  lock_release(&dirty_lock);
+}
+
+/* Arranges for SECTOR of ENTRY, just changed by an ACCESS, to
+   reach disk: through the journal if it is metadata or already
+   journaled, otherwise by write-back.  The caller must hold the
+   sector's lock for writing. */
+static void note_write(struct buffer_cache_entry* entry, block_sector_t sector,
+                       enum cache_access access) {
+  size_t idx = sector - entry->sector;
+
+  if (journal_log(sector, buffer_cache_data(entry, sector), access == CACHE_METADATA))
+    clear_dirty(entry, idx, false);
+  else
+    mark_dirty(entry, idx);
+}
+
+/* Writes ENTRY's dirty sectors back to disk one at a time,
+   directly from the cache.  ENTRY must be pinned.  Only one of
+   ENTRY's locks is held at a time, so readers of its other
+   sectors may continue during the writes. */
+static void write_back_entry(struct buffer_cache_entry* entry) {
+  size_t cnt = block_sector_cnt(entry);
+
+  for (size_t i = 0; i < cnt; i++) {
+    if (!(entry->dirty & (1 << i)))
+      continue;
+    rw_lock_acquire(&entry->locks[i], RW_READER);
+    if (entry->dirty & (1 << i)) {
+      block_write(fs_device, entry->sector + i, (uint8_t*)entry->data + i * BLOCK_SECTOR_SIZE);
+      clear_dirty(entry, i, true);
     }
+    rw_lock_release(&entry->locks[i], RW_READER);
   }
+}
 
-  while (true) {
-    entry = clock_hand;
-    if (!entry->accessed) {
-      if (entry->dirty) {
-        lock_release(&buffer_cache_lock);
-        lock_acquire(&entry->lock);
-        block_write(fs_device, entry->sector, entry->data);
-        lock_release(&entry->lock);
-        lock_acquire(&buffer_cache_lock);
-      }
+/* Returns an entry that is neither bound nor pinned, pinning it.
+   Takes a free entry if there is one, growing the cache if
+   possible; otherwise asks the replacement policy for candidates
+   until one is neither pinned nor recently accessed, and removes
+   it from the index.  Dirty candidates are left to the flusher
+   during the first sweep.  After that they are written back here
+   (outside evict_lock, while still bound so readers keep finding
+   the current data) and reconsidered. */
+static struct buffer_cache_entry* pick_victim(void) {
+  struct buffer_cache_entry* entry;
+  size_t scanned = 0;
 
-      entry->sector = sector;
-      entry->valid = true;
-      entry->dirty = false;
-      entry->accessed = true;
+  lock_acquire(&evict_lock);
+  if (list_empty(&free_entries))
+    grow_cache();
+  if (!list_empty(&free_entries)) {
+    entry = list_entry(list_pop_front(&free_entries), struct buffer_cache_entry, elem);
+    entry->pin_cnt = 1;
+    lock_release(&evict_lock);
+    return entry;
+  }
 
-      lock_release(&buffer_cache_lock);
-      block_read(fs_device, sector, entry->data);
-      lock_acquire(&buffer_cache_lock);
+  while (true) {
+    entry = policy->candidate();
+    if (entry == NULL || scanned++ >= 2 * active_cnt) {
+      /* Every entry is pinned; let the holders make progress. */
+      lock_release(&evict_lock);
+      thread_yield();
+      lock_acquire(&evict_lock);
+      scanned = 0;
+      continue;
+    }
+    if (!entry->valid)
+      continue;
 
-      e = list_next(&clock_hand->elem);
-      if (e == list_end(&buffer_cache)) {
-        clock_hand = list_entry(list_begin(&buffer_cache), struct buffer_cache_entry, elem);
-      } else {
-        clock_hand = list_entry(e, struct buffer_cache_entry, elem);
-      }
-      return entry;
-    } else {
+    struct buffer_cache_shard* shard = shard_of(entry->sector);
+    lock_acquire(&shard->lock);
+    if (entry->pin_cnt > 0) {
+      lock_release(&shard->lock);
+      policy->skip(entry);
+    } else if (entry->accessed) {
       entry->accessed = false;
-      e = list_next(&clock_hand->elem);
-      if (e == list_end(&buffer_cache)) {
-        clock_hand = list_entry(list_begin(&buffer_cache), struct buffer_cache_entry, elem);
-      } else {
-        clock_hand = list_entry(e, struct buffer_cache_entry, elem);
-      }
+      lock_release(&shard->lock);
+      policy->touch(entry);
+    } else if (entry->dirty && scanned <= active_cnt) {
+      lock_release(&shard->lock);
+      lock_acquire(&dirty_lock);
+      request_flush();
+      lock_release(&dirty_lock);
+      policy->skip(entry);
+    } else if (entry->dirty) {
+      entry->pin_cnt++;
+      lock_release(&shard->lock);
+      lock_release(&evict_lock);
+      write_back_entry(entry);
+      unpin_entry(entry);
+      lock_acquire(&evict_lock);
+    } else {
+      hash_delete(&shard->index, &entry->hash_elem);
+      entry->valid = false;
+      lock_release(&shard->lock);
+      policy->remove(entry, true);
+      evict_cnt++;
+      break;
     }
   }
+  entry->pin_cnt = 1;
+  lock_release(&evict_lock);
+  return entry;
 }
 
-void buffer_cache_read(block_sector_t sector, void* buffer_, off_t size, off_t offset) {
+/* Records an ACCESS that found ENTRY in SHARD.  SHARD's lock
+   must be held. */
+static void count_hit(struct buffer_cache_shard* shard, struct buffer_cache_entry* entry,
+                      enum cache_access access) {
+  if (access == CACHE_PREFETCH)
+    return;
+  shard->hits[access]++;
+  if (entry->prefetched) {
+    entry->prefetched = false;
+    shard->readahead_hits++;
+  }
+}
+
+/* Takes sector IDX of ENTRY, a block in SHARD, for writing if
+   EXCLUSIVE, otherwise for reading, and records how long that
+   took. */
+static void lock_sector(struct buffer_cache_shard* shard, struct buffer_cache_entry* entry,
+                        size_t idx, bool exclusive) {
+  int64_t start = timer_ticks();
+  int64_t waited;
+
+  rw_lock_acquire(&entry->locks[idx], !exclusive);
+  waited = timer_elapsed(start);
+  if (waited > 0) {
+    lock_acquire(&shard->lock);
+    shard->wait_ticks += waited;
+    lock_release(&shard->lock);
+  }
+}
+
+/* Returns the entry caching the block that contains SECTOR,
+   pinned and with SECTOR's lock held for writing if EXCLUSIVE,
+   otherwise for reading.  On a miss, a victim entry is rebound to
+   the block and filled from disk with a single request.  ACCESS
+   says how to account for the access in the statistics. */
+static struct buffer_cache_entry* acquire_entry(block_sector_t sector, bool exclusive,
+                                                enum cache_access access) {
+  block_sector_t block = block_of(sector);
+  size_t idx = sector - block;
+  struct buffer_cache_shard* shard = shard_of(block);
   struct buffer_cache_entry* entry;
-  lock_acquire(&buffer_cache_lock);
+  struct buffer_cache_entry* victim;
 
-  entry = find_buffer_cache_entry(sector);
+  lock_acquire(&shard->lock);
+  entry = find_entry(shard, block);
   if (entry != NULL) {
-    memcpy(buffer_, entry->data + offset, size);
+    entry->pin_cnt++;
     entry->accessed = true;
-    hit_count += 1;
-  } else {
-    entry = load_new_entry(sector);
-    memcpy(buffer_, entry->data + offset, size);
-    miss_count += 1;
+    count_hit(shard, entry, access);
+    lock_release(&shard->lock);
+    lock_sector(shard, entry, idx, exclusive);
+    return entry;
+  }
+  lock_release(&shard->lock);
+
+  /* Miss.  The victim is pinned and unbound, so nobody else can
+     reach it and taking all of its locks does not block. */
+  victim = pick_victim();
+  for (size_t i = 0; i < CACHE_BLOCK_SECTORS; i++)
+    rw_lock_acquire(&victim->locks[i], RW_WRITER);
+
+  /* Another thread may have loaded the block while we were
+     looking for a victim. */
+  lock_acquire(&evict_lock);
+  lock_acquire(&shard->lock);
+  entry = find_entry(shard, block);
+  if (entry != NULL) {
+    entry->pin_cnt++;
+    entry->accessed = true;
+    count_hit(shard, entry, access);
+    lock_release(&shard->lock);
+    victim->pin_cnt = 0;
+    list_push_front(&free_entries, &victim->elem);
+    lock_release(&evict_lock);
+    for (size_t i = 0; i < CACHE_BLOCK_SECTORS; i++)
+      rw_lock_release(&victim->locks[i], RW_WRITER);
+    lock_sector(shard, entry, idx, exclusive);
+    return entry;
+  }
+  victim->sector = block;
+  victim->valid = true;
+  victim->dirty = 0;
+  victim->accessed = true;
+  victim->prefetched = access == CACHE_PREFETCH;
+  if (access != CACHE_PREFETCH)
+    shard->misses[access]++;
+  hash_insert(&shard->index, &victim->hash_elem);
+  lock_release(&shard->lock);
+  policy->insert(victim);
+  lock_release(&evict_lock);
+
+  /* Threads that find the entry now block on its locks until it
+     has been filled.  Sectors whose latest version is still only
+     in the journal are taken from there; if a checkpoint writes
+     sectors home meanwhile, the block is read again. */
+  unsigned epoch;
+  do {
+    epoch = journal_epoch();
+    block_read_multiple(fs_device, block, block_sector_cnt(victim), victim->data);
+  } while (!journal_overlay(block, block_sector_cnt(victim), victim->data, epoch));
+  for (size_t i = 0; i < CACHE_BLOCK_SECTORS; i++)
+    if (i != idx)
+      rw_lock_release(&victim->locks[i], RW_WRITER);
+  if (!exclusive) {
+    rw_lock_release(&victim->locks[idx], RW_WRITER);
+    rw_lock_acquire(&victim->locks[idx], RW_READER);
   }
-  lock_release(&buffer_cache_lock);
+  return victim;
 }
 
-struct buffer_cache_entry* write_new_entry(block_sector_t sector) {
+/* Releases SECTOR of an entry returned by acquire_entry(). */
+static void release_entry(struct buffer_cache_entry* entry, block_sector_t sector,
+                          bool exclusive) {
+  rw_lock_release(&entry->locks[sector - entry->sector], !exclusive);
+  unpin_entry(entry);
+}
+
+/* Copies SIZE bytes at OFFSET within SECTOR into BUFFER_.
+   ACCESS says whether SECTOR holds file data or metadata. */
+void buffer_cache_read(block_sector_t sector, void* buffer_, off_t size, off_t offset,
+                       enum cache_access access) {
   struct buffer_cache_entry* entry;
-  struct list_elem* e;
-
-  for (e = list_begin(&buffer_cache); e != list_end(&buffer_cache); e = list_next(e)) {
-    entry = list_entry(e, struct buffer_cache_entry, elem);
-    if (!entry->valid) {
-      entry->sector = sector;
-      entry->valid = true;
-      entry->dirty = false;
-      entry->accessed = true;
-      return entry;
-    }
+
+  entry = acquire_entry(sector, false, access);
+  memcpy(buffer_, buffer_cache_data(entry, sector) + offset, size);
+  release_entry(entry, sector, false);
+}
+
+/* Copies SIZE bytes from BUFFER_ to OFFSET within SECTOR.
+   ACCESS says whether SECTOR holds file data or metadata. */
+void buffer_cache_write(block_sector_t sector, const void* buffer_, off_t size, off_t offset,
+                        enum cache_access access) {
+  struct buffer_cache_entry* entry;
+
+  entry = acquire_entry(sector, true, access);
+  memcpy(buffer_cache_data(entry, sector) + offset, buffer_, size);
+  note_write(entry, sector, access);
+  release_entry(entry, sector, true);
+}
+
+/* Returns the cache entry holding SECTOR, pinned and with the
+   sector's lock held for writing if EXCLUSIVE, otherwise for
+   reading, so that the caller can use the sector's data, found
+   with buffer_cache_data(), in place.  The sector must be
+   released with buffer_cache_put().  A thread must not hold the
+   same sector twice at once, but may hold other sectors of the
+   same block.  In-place access is meant for metadata and is
+   counted as such. */
+struct buffer_cache_entry* buffer_cache_get(block_sector_t sector, bool exclusive) {
+  struct buffer_cache_entry* entry;
+
+  entry = acquire_entry(sector, exclusive, CACHE_METADATA);
+  entry->exclusive[sector - entry->sector] = exclusive;
+  return entry;
+}
+
+/* Returns the data of SECTOR, which ENTRY must cache. */
+void* buffer_cache_data(struct buffer_cache_entry* entry, block_sector_t sector) {
+  ASSERT(sector - entry->sector < CACHE_BLOCK_SECTORS);
+  return (uint8_t*)entry->data + (sector - entry->sector) * BLOCK_SECTOR_SIZE;
+}
+
+/* Releases SECTOR of ENTRY, obtained from buffer_cache_get().
+   If DIRTY, the caller modified the sector's data, which requires
+   that it was obtained for exclusive use. */
+void buffer_cache_put(struct buffer_cache_entry* entry, block_sector_t sector, bool dirty) {
+  size_t idx = sector - entry->sector;
+  bool exclusive = entry->exclusive[idx];
+
+  ASSERT(exclusive || !dirty);
+  if (dirty)
+    note_write(entry, sector, CACHE_METADATA);
+  entry->exclusive[idx] = false;
+  release_entry(entry, sector, exclusive);
+}
+
+/* Queues the block containing SECTOR to be loaded into the cache
+   in the background.  The request is dropped if the queue is full
+   or the block was the last one queued. */
+void buffer_cache_prefetch(block_sector_t sector) {
+  block_sector_t block = block_of(sector);
+  size_t tail;
+
+  if (sector == (block_sector_t)-1)
+    return;
+
+  lock_acquire(&readahead_lock);
+  tail = (readahead_head + readahead_cnt + READAHEAD_QUEUE_SIZE - 1) % READAHEAD_QUEUE_SIZE;
+  if (readahead_cnt < READAHEAD_QUEUE_SIZE &&
+      (readahead_cnt == 0 || readahead_queue[tail] != block)) {
+    readahead_queue[(readahead_head + readahead_cnt++) % READAHEAD_QUEUE_SIZE] = block;
+    sema_up(&readahead_pending);
   }
+  lock_release(&readahead_lock);
+}
+
+/* Read-ahead worker thread.  Loads queued blocks into the cache
+   one at a time. */
+static void buffer_cache_readahead(void* aux UNUSED) {
+  struct buffer_cache_entry* entry;
+  block_sector_t sector;
 
   while (true) {
-    entry = clock_hand;
-    if (!entry->accessed) {
-      if (entry->dirty) {
-        lock_release(&buffer_cache_lock);
-        lock_acquire(&entry->lock);
-        block_write(fs_device, entry->sector, entry->data);
-        lock_release(&entry->lock);
-        lock_acquire(&buffer_cache_lock);
-      }
+    sema_down(&readahead_pending);
+    lock_acquire(&readahead_lock);
+    sector = readahead_queue[readahead_head];
+    readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+    readahead_cnt--;
+    lock_release(&readahead_lock);
 
-      entry->sector = sector;
-      entry->valid = true;
-      entry->dirty = false;
-      entry->accessed = true;
+    entry = acquire_entry(sector, false, CACHE_PREFETCH);
+    release_entry(entry, sector, false);
+  }
+}
 
-      e = list_next(&clock_hand->elem);
-      if (e == list_end(&buffer_cache)) {
-        clock_hand = list_entry(list_begin(&buffer_cache), struct buffer_cache_entry, elem);
-      } else {
-        clock_hand = list_entry(e, struct buffer_cache_entry, elem);
-      }
-      return entry;
-    } else {
-      entry->accessed = false;
-      e = list_next(&clock_hand->elem);
-      if (e == list_end(&buffer_cache)) {
-        clock_hand = list_entry(list_begin(&buffer_cache), struct buffer_cache_entry, elem);
-      } else {
-        clock_hand = list_entry(e, struct buffer_cache_entry, elem);
-      }
+/* Pins and returns the entry at index I of the cache if it holds
+   dirty data, otherwise returns a null pointer. */
+static struct buffer_cache_entry* pin_if_dirty(size_t i) {
+  struct buffer_cache_entry* entry = &buffer_cache[i];
+  struct buffer_cache_entry* pinned = NULL;
+
+  lock_acquire(&evict_lock);
+  if (i < active_cnt && entry->valid) {
+    struct buffer_cache_shard* shard = shard_of(entry->sector);
+    lock_acquire(&shard->lock);
+    if (entry->dirty) {
+      entry->pin_cnt++;
+      pinned = entry;
     }
+    lock_release(&shard->lock);
   }
+  lock_release(&evict_lock);
+  return pinned;
 }
 
-void buffer_cache_write(block_sector_t sector, void* buffer_, off_t size, off_t offset) {
-  struct buffer_cache_entry* entry;
-  lock_acquire(&buffer_cache_lock);
+/* Orders cache entries by ascending sector. */
+static int compare_sector(const void* a_, const void* b_) {
+  const struct buffer_cache_entry* a = *(struct buffer_cache_entry* const*)a_;
+  const struct buffer_cache_entry* b = *(struct buffer_cache_entry* const*)b_;
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
 
-  entry = find_buffer_cache_entry(sector);
-  if (entry != NULL) {
-    memcpy(entry->data + offset, buffer_, size);
-    entry->accessed = true;
-    entry->dirty = true;
-  } else {
-    entry = write_new_entry(sector);
-    memcpy(entry->data + offset, buffer_, size);
-    entry->dirty = true;
+/* Writes out the run gathered in FLUSH_BUFFER, if any. */
+static void flush_run(void) {
+  if (run_cnt > 0) {
+    block_write_multiple(fs_device, run_start, run_cnt, flush_buffer);
+    run_cnt = 0;
   }
-  lock_release(&buffer_cache_lock);
 }
 
+/* Adds ENTRY's dirty sectors to the run being gathered, writing
+   the run out first whenever the next dirty sector does not
+   extend it.  Each sector is copied under its own lock, which is
+   the only lock of ENTRY held, so readers and writers of the
+   block wait at most for one copy.  The sectors are marked clean
+   as they are copied; the caller keeps ENTRY pinned until the run
+   is on disk, so it cannot be evicted and reread too early. */
+static void gather_entry(struct buffer_cache_entry* entry) {
+  size_t cnt = block_sector_cnt(entry);
+
+  for (size_t i = 0; i < cnt; i++) {
+    block_sector_t sector = entry->sector + i;
+
+    if (!(entry->dirty & (1 << i)))
+      continue;
+    if (run_cnt > 0 && (sector != run_start + run_cnt || run_cnt == FLUSH_RUN_SECTORS))
+      flush_run();
+
+    rw_lock_acquire(&entry->locks[i], RW_READER);
+    if (entry->dirty & (1 << i)) {
+      if (run_cnt == 0)
+        run_start = sector;
+      memcpy(flush_buffer + run_cnt++ * BLOCK_SECTOR_SIZE,
+             (uint8_t*)entry->data + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+      clear_dirty(entry, i, true);
+    }
+    rw_lock_release(&entry->locks[i], RW_READER);
+  }
+}
+
+/* Writes back every dirty sector.  The dirty entries are pinned
+   and sorted by sector, so the disk head sweeps once across the
+   device, and adjacent dirty sectors, within a block or across
+   neighbouring blocks, are merged into multi-sector writes.  No
+   global lock is held while copying or writing, so other threads
+   keep using the cache throughout. */
 void buffer_cache_flush_all_entries(void) {
-  struct list_elem* e;
   struct buffer_cache_entry* entry;
+  size_t cnt = 0;
 
-  lock_acquire(&buffer_cache_lock);
-  for (e = list_begin(&buffer_cache); e != list_end(&buffer_cache); e = list_next(e)) {
-    entry = list_entry(e, struct buffer_cache_entry, elem);
+  lock_acquire(&flush_lock);
+  for (size_t i = 0; i < active_cnt; i++) {
+    entry = pin_if_dirty(i);
+    if (entry != NULL)
+      flush_batch[cnt++] = entry;
+  }
+  qsort(flush_batch, cnt, sizeof *flush_batch, compare_sector);
+  for (size_t i = 0; i < cnt; i++)
+    gather_entry(flush_batch[i]);
+  flush_run();
+  for (size_t i = 0; i < cnt; i++)
+    unpin_entry(flush_batch[i]);
+  lock_release(&flush_lock);
+}
 
-    if (entry->valid && entry->dirty) {
-      lock_release(&buffer_cache_lock);
+/* Waits for any flush pass in progress and keeps new ones from
+   starting until buffer_cache_resume_flushes().  A pass writes
+   copies of sectors taken earlier without holding their locks, so
+   a sector freed and reused as metadata meanwhile could be
+   overwritten by its old contents; the journal holds passes off
+   while it writes metadata home. */
+void buffer_cache_hold_flushes(void) { lock_acquire(&flush_lock); }
 
-      lock_acquire(&entry->lock);
-      block_write(fs_device, entry->sector, entry->data);
-      lock_release(&entry->lock);
+/* Lets flush passes run again after buffer_cache_hold_flushes(). */
+void buffer_cache_resume_flushes(void) { lock_release(&flush_lock); }
 
-      lock_acquire(&buffer_cache_lock);
-      entry->dirty = false;
-    }
+/* Flusher thread.  Blocks until the flush interval has passed or
+   a writer asks for an early flush, then commits the journal,
+   which takes in changed inodes and the free map's changed
+   sectors, and writes back everything that is dirty. */
+static void buffer_cache_flusher(void* aux UNUSED) {
+  while (true) {
+    timer_sema_down(&flush_wakeup, flush_interval);
+    lock_acquire(&dirty_lock);
+    flush_requested = false;
+    lock_release(&dirty_lock);
+    journal_commit();
+    buffer_cache_flush_all_entries();
   }
-  lock_release(&buffer_cache_lock);
 }
 
 void buffer_cache_reset(void) {
   buffer_cache_flush_all_entries();
-  lock_acquire(&buffer_cache_lock);
-  struct list_elem* e;
-  for (e = list_begin(&buffer_cache); e != list_end(&buffer_cache); e = list_next(e)) {
-    struct buffer_cache_entry* entry = list_entry(e, struct buffer_cache_entry, elem);
-    entry->valid = false;
-    entry->dirty = false;
-    entry->accessed = false;
+  lock_acquire(&evict_lock);
+  for (size_t i = 0; i < active_cnt; i++) {
+    struct buffer_cache_entry* entry = &buffer_cache[i];
+    if (!entry->valid)
+      continue;
+    struct buffer_cache_shard* shard = shard_of(entry->sector);
+    lock_acquire(&shard->lock);
+    if (entry->pin_cnt == 0 && !entry->dirty) {
+      hash_delete(&shard->index, &entry->hash_elem);
+      entry->valid = false;
+      entry->accessed = false;
+      policy->remove(entry, false);
+      list_push_back(&free_entries, &entry->elem);
+    }
+    lock_release(&shard->lock);
   }
-  lock_release(&buffer_cache_lock);
+  shrink_cache();
+  lock_release(&evict_lock);
 }
 
-int get_buffer_cache_hit_rate() { return hit_count / (hit_count + miss_count); }
+/* Stores the buffer cache statistics in *STATS. */
+void buffer_cache_get_stats(struct cache_stats* stats) {
+  int64_t wait_ticks = 0;
 
-void reset_buffer_cache_stats() {
-  hit_count = 0;
-  miss_count = 0;
+  memset(stats, 0, sizeof *stats);
+  for (int i = 0; i < BUFFER_CACHE_SHARDS; i++) {
+    struct buffer_cache_shard* shard = &buffer_cache_shards[i];
+    lock_acquire(&shard->lock);
+    stats->metadata_hits += shard->hits[CACHE_METADATA];
+    stats->metadata_misses += shard->misses[CACHE_METADATA];
+    stats->data_hits += shard->hits[CACHE_DATA];
+    stats->data_misses += shard->misses[CACHE_DATA];
+    stats->readahead_hits += shard->readahead_hits;
+    wait_ticks += shard->wait_ticks;
+    lock_release(&shard->lock);
+  }
+  stats->lock_wait_ms = wait_ticks * 1000 / TIMER_FREQ;
+
+  lock_acquire(&evict_lock);
+  stats->evictions = evict_cnt;
+  lock_release(&evict_lock);
+
+  lock_acquire(&dirty_lock);
+  stats->writebacks = writeback_cnt;
+  stats->dirty = dirty_sector_cnt;
+  lock_release(&dirty_lock);
+}
+
+/* Resets the buffer cache statistics counters. */
+void reset_buffer_cache_stats(void) {
+  for (int i = 0; i < BUFFER_CACHE_SHARDS; i++) {
+    struct buffer_cache_shard* shard = &buffer_cache_shards[i];
+    lock_acquire(&shard->lock);
+    memset(shard->hits, 0, sizeof shard->hits);
+    memset(shard->misses, 0, sizeof shard->misses);
+    shard->readahead_hits = 0;
+    shard->wait_ticks = 0;
+    lock_release(&shard->lock);
+  }
+
+  lock_acquire(&evict_lock);
+  evict_cnt = 0;
+  lock_release(&evict_lock);
+
+  lock_acquire(&dirty_lock);
+  writeback_cnt = 0;
+  lock_release(&dirty_lock);
+}
+
+/* Inode format that do_format() gives the new file system. */
+static enum inode_format new_format = INODE_INDEXED;
+
+/* Makes do_format() create inodes in the format called NAME,
+   "indexed" or "extent".  Returns false if there is no such
+   format. */
+bool filesys_set_format(const char* name) {
+  if (!strcmp(name, "indexed"))
+    new_format = INODE_INDEXED;
+  else if (!strcmp(name, "extent"))
+    new_format = INODE_EXTENT;
+  else
+    return false;
+  return true;
 }
 
 /* Initializes the file system module.
@@ -249,14 +1020,20 @@ void filesys_init(bool format) {
     PANIC("No file system device found, can't initialize file system.");
 
   inode_init();
+  dcache_init();
   free_map_init();
   buffer_cache_init();
+  journal_init();
+  thread_create("cache-flusher", PRI_DEFAULT, buffer_cache_flusher, NULL);
+  thread_create("cache-readahead", PRI_DEFAULT, buffer_cache_readahead, NULL);
 
   if (format)
     do_format();
 
+  journal_open();
   free_map_open();
   struct dir* dir = dir_open_root();
+  inode_set_format(inode_get_format(dir->inode));
   dir_add(dir, ".", inode_get_inumber(dir->inode));
   dir_add(dir, "..", inode_get_inumber(dir->inode));
   dir_close(dir);
@@ -265,6 +1042,7 @@ void filesys_init(bool format) {
 /* Shuts down the file system module, writing any unwritten data
    to disk. */
 void filesys_done(void) {
+  journal_close();
   free_map_close();
   buffer_cache_flush_all_entries();
 }
@@ -276,29 +1054,23 @@ void filesys_done(void) {
 bool filesys_create(const char* name, off_t initial_size) {
   block_sector_t inode_sector = 0;
   struct process* p = thread_current()->pcb;
-  struct dir* dir;
-  char* addr;
-  char* new;
-  splitPath(name, &addr, &new);
-  if (name[0] == '/') {
-    dir = find_dir(addr, NULL);
-  } else {
-    dir = find_dir(addr, p->cwd);
-  }
+  char new[NAME_MAX + 1];
+  journal_begin();
+  struct dir* dir = find_parent(name, p->cwd, new);
   if (dir == NULL || dir->inode->removed) {
     dir_close(dir);
-    free(addr);
-    free(new);
+    journal_end();
     return false;
   }
-  bool success = (dir != NULL && free_map_allocate(1, &inode_sector) &&
-                  inode_create(inode_sector, initial_size) && dir_add(dir, new, inode_sector));
+  bool success = (dir != NULL &&
+                  free_map_allocate_inode(inode_get_inumber(dir->inode), false, &inode_sector) &&
+                  inode_create(inode_sector, initial_size, false) &&
+                  dir_add(dir, new, inode_sector));
   if (!success && inode_sector != 0) {
     free_map_release(inode_sector, 1);
   }
   dir_close(dir);
-  free(addr);
-  free(new);
+  journal_end();
 
   return success;
 }
@@ -310,28 +1082,17 @@ bool filesys_create(const char* name, off_t initial_size) {
    or if an internal memory allocation fails. */
 struct file* filesys_open(const char* name) {
   struct process* p = thread_current()->pcb;
-  struct dir* dir;
-  char* addr;
-  char* new;
-  splitPath(name, &addr, &new);
-  if (name[0] == '/') {
-    dir = find_dir(addr, NULL);
-  } else {
-    dir = find_dir(addr, p->cwd);
-  }
+  char new[NAME_MAX + 1];
+  struct dir* dir = find_parent(name, p->cwd, new);
   struct inode* inode = NULL;
   if (dir == NULL || dir->inode->removed) {
     dir_close(dir);
-    free(addr);
-    free(new);
     return NULL;
   }
   if (dir != NULL) {
     dir_lookup(dir, new, &inode);
   }
   dir_close(dir);
-  free(addr);
-  free(new);
   return file_open(inode);
 }
 
@@ -341,35 +1102,31 @@ struct file* filesys_open(const char* name) {
    or if an internal memory allocation fails. */
 bool filesys_remove(const char* name) {
   struct process* p = thread_current()->pcb;
-  struct dir* dir;
-  char* addr;
-  char* new;
-  splitPath(name, &addr, &new);
-  if (name[0] == '/') {
-    dir = find_dir(addr, NULL);
-  } else {
-    dir = find_dir(addr, p->cwd);
-  }
+  char new[NAME_MAX + 1];
+  journal_begin();
+  struct dir* dir = find_parent(name, p->cwd, new);
   if (dir == NULL || dir->inode->removed) {
     dir_close(dir);
-    free(addr);
-    free(new);
+    journal_end();
     return false;
   }
   bool success = dir != NULL && dir_remove(dir, new);
   dir_close(dir);
-  free(addr);
-  free(new);
+  journal_end();
 
   return success;
 }
 
-/* Formats the file system. */
+/* Formats the file system.  Nothing is journaled yet, so the new
+   file system is written to disk before the journal is opened. */
 static void do_format(void) {
   printf("Formatting file system...");
+  inode_set_format(new_format);
   free_map_create();
   if (!dir_create(ROOT_DIR_SECTOR, 16))
     PANIC("root directory creation failed");
+  journal_create();
   free_map_close();
+  buffer_cache_flush_all_entries();
   printf("done.\n");
 }
@@ -2,6 +2,7 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include <hash.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 #include "threads/synch.h"
@@ -9,29 +10,58 @@
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0 /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1 /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2  /* Journal log header sector. */
 
 /* Block device that contains the file system. */
 extern struct block* fs_device;
 
+/* Sectors per buffer cache block: one page. */
+#define CACHE_BLOCK_SECTORS 8
+
 struct buffer_cache_entry {
-  block_sector_t sector;
-  bool valid;
-  bool dirty;
+  block_sector_t sector; /* First sector of the cached block. */
+  bool valid;            /* Bound to SECTOR in the index? */
+  uint8_t dirty;         /* Bitmap of sectors modified since written back. */
   bool accessed;
-  void* data;
-  struct lock lock;
-  struct list_elem elem;
+  bool prefetched;       /* Loaded by read-ahead and not used since? */
+  int pin_cnt; /* Number of threads using the entry; blocks eviction. */
+  int queue;   /* Replacement policy queue holding the entry. */
+  void* data;  /* CACHE_BLOCK_SECTORS sectors of data. */
+  bool exclusive[CACHE_BLOCK_SECTORS];       /* Held for writing through buffer_cache_get()? */
+  struct rw_lock locks[CACHE_BLOCK_SECTORS]; /* Guard each sector's data and DIRTY bit. */
+  struct hash_elem hash_elem;                /* Element in the block index. */
+  struct list_elem elem; /* Element in the free list or a policy queue. */
+};
+
+void buffer_cache_configure(size_t sectors);
+void buffer_cache_set_flush_interval(int ms);
+void buffer_cache_set_dirty_ratio(int pct);
+bool buffer_cache_set_policy(const char* name);
+/* How a buffer cache access is counted in the statistics. */
+enum cache_access {
+  CACHE_DATA,     /* Contents of an ordinary file. */
+  CACHE_METADATA, /* Inodes, indirect blocks, directories, free map. */
+  CACHE_PREFETCH  /* Read-ahead; not counted until used. */
 };
 
-void buffer_cache_read(block_sector_t, void*, off_t, off_t);
-void buffer_cache_write(block_sector_t, void*, off_t, off_t);
+struct cache_stats;
+
+void buffer_cache_read(block_sector_t, void*, off_t, off_t, enum cache_access);
+void buffer_cache_write(block_sector_t, const void*, off_t, off_t, enum cache_access);
+void buffer_cache_prefetch(block_sector_t);
+struct buffer_cache_entry* buffer_cache_get(block_sector_t, bool exclusive);
+void* buffer_cache_data(struct buffer_cache_entry*, block_sector_t);
+void buffer_cache_put(struct buffer_cache_entry*, block_sector_t, bool dirty);
+void buffer_cache_hold_flushes(void);
+void buffer_cache_resume_flushes(void);
 void filesys_init(bool format);
+bool filesys_set_format(const char* name);
 void filesys_done(void);
 bool filesys_create(const char* name, off_t initial_size);
 struct file* filesys_open(const char* name);
 bool filesys_remove(const char* name);
 
-int get_buffer_cache_hit_rate();
-void reset_buffer_cache_stats();
+void buffer_cache_get_stats(struct cache_stats*);
+void reset_buffer_cache_stats(void);
 
 #endif /* filesys/filesys.h */
@@ -1,68 +1,336 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Number of free map bits stored in one sector of the free map
+   file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* The disk is divided into block groups of GROUP_SECTORS
+   sectors.  The first INODE_SECTORS sectors of each group are
+   where inodes go; the rest holds the data of the files whose
+   inodes are in the group, so that a file's inode and data, and
+   the files of one directory, stay close together.  Group 0's
+   inode area starts with the free map and root directory
+   inodes and the journal's log header.
+
+   The free map is summarized at two levels so that allocation
+   can skip over used space without testing every bit: a free
+   count for each block group, and a bit for each word of
+   WORD_SECTORS sectors that is set once the whole word is in
+   use.
+
+   A released sector is clear in the free map, which is what goes
+   to disk, but is not allocated again until the journal has
+   committed the transaction that released it.  Until then a crash
+   could bring back metadata that still points to it, so it must
+   not hold anything else yet.  RELEASED holds the sectors released
+   since the running transaction began, and COMMITTING those of the
+   transaction being committed. */
+#define GROUP_SECTORS 1024
+#define INODE_SECTORS 64
+#define WORD_SECTORS 32
 
 static struct file* free_map_file; /* Free map file. */
 static struct bitmap* free_map;    /* Free map, one bit per sector. */
+static struct bitmap* dirty_map;   /* Free map file sectors not yet written. */
+static size_t* group_free;         /* Free sectors in each group. */
+static struct bitmap* full_words;  /* Words with no free sectors. */
+static struct bitmap* released;    /* Released, not yet committed. */
+static struct bitmap* committing;  /* Released, being committed. */
+static size_t cursor;              /* Where the next search starts. */
+static struct lock free_map_lock;  /* Protects the variables above. */
+
+/* Returns the number of block groups. */
+static size_t group_cnt(void) { return DIV_ROUND_UP(bitmap_size(free_map), GROUP_SECTORS); }
+
+/* Returns the sector just past the end of block group G. */
+static size_t group_end(size_t g) {
+  size_t end = (g + 1) * GROUP_SECTORS;
+  return end < bitmap_size(free_map) ? end : bitmap_size(free_map);
+}
+
+/* Recomputes whether the word holding SECTOR is full. */
+static void update_word(size_t sector) {
+  size_t start = sector - sector % WORD_SECTORS;
+  size_t cnt = bitmap_size(free_map) - start;
+  if (cnt > WORD_SECTORS)
+    cnt = WORD_SECTORS;
+  bitmap_set(full_words, start / WORD_SECTORS, bitmap_all(free_map, start, cnt));
+}
+
+/* Recomputes the summary of the whole free map. */
+static void rebuild_summary(void) {
+  for (size_t g = 0; g < group_cnt(); g++)
+    group_free[g] = bitmap_count(free_map, g * GROUP_SECTORS, group_end(g) - g * GROUP_SECTORS,
+                                 false);
+  for (size_t w = 0; w < bitmap_size(full_words); w++)
+    update_word(w * WORD_SECTORS);
+}
+
+/* Returns true if SECTOR may be allocated. */
+static bool available(size_t sector) {
+  return !bitmap_test(free_map, sector) && !bitmap_test(released, sector) &&
+         !bitmap_test(committing, sector);
+}
+
+/* Marks the CNT sectors starting at SECTOR, all of which are
+   currently !USED, as USED, keeping the summary up to date and
+   noting the free map file sectors that must be written. */
+static void set_sectors(block_sector_t sector, size_t cnt, bool used) {
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple(free_map, sector, cnt, used);
+  for (size_t i = sector; i < sector + cnt; i++) {
+    if (used)
+      group_free[i / GROUP_SECTORS]--;
+    else
+      group_free[i / GROUP_SECTORS]++;
+    if (i == sector || i % WORD_SECTORS == 0)
+      update_word(i);
+  }
+  bitmap_set_multiple(dirty_map, first, last - first + 1, true);
+}
+
+/* Returns the first sector of a run of CNT free sectors that
+   starts at or after START and ends by END, or BITMAP_ERROR if
+   there is none.  Full groups and words are skipped whole. */
+static size_t scan_free(size_t start, size_t end, size_t cnt) {
+  size_t run = 0;
+
+  for (size_t i = start; i < end;) {
+    if (run == 0 && group_free[i / GROUP_SECTORS] == 0) {
+      i = ROUND_DOWN(i, GROUP_SECTORS) + GROUP_SECTORS;
+      continue;
+    }
+    if (run == 0 && i % WORD_SECTORS == 0 && bitmap_test(full_words, i / WORD_SECTORS)) {
+      i += WORD_SECTORS;
+      continue;
+    }
+    if (available(i)) {
+      if (++run == cnt)
+        return i + 1 - cnt;
+    } else {
+      run = 0;
+    }
+    i++;
+  }
+  return BITMAP_ERROR;
+}
+
+/* Returns the first sector of a run of CNT free sectors, looking
+   from START to END and then wrapping around from the start of
+   the disk, or BITMAP_ERROR if there is none. */
+static size_t scan_free_wrap(size_t start, size_t end, size_t cnt) {
+  size_t sector = scan_free(start, end, cnt);
+  if (sector == BITMAP_ERROR && start > 0)
+    sector = scan_free(0, start + cnt - 1 < end ? start + cnt - 1 : end, cnt);
+  return sector;
+}
 
 /* Initializes the free map. */
 void free_map_init(void) {
-  free_map = bitmap_create(block_size(fs_device));
+  size_t sectors = block_size(fs_device);
+
+  free_map = bitmap_create(sectors);
   if (free_map == NULL)
     PANIC("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create(DIV_ROUND_UP(sectors, BITS_PER_SECTOR));
+  group_free = malloc(DIV_ROUND_UP(sectors, GROUP_SECTORS) * sizeof *group_free);
+  full_words = bitmap_create(DIV_ROUND_UP(sectors, WORD_SECTORS));
+  released = bitmap_create(sectors);
+  committing = bitmap_create(sectors);
+  if (dirty_map == NULL || group_free == NULL || full_words == NULL || released == NULL ||
+      committing == NULL)
+    PANIC("free map summary creation failed");
+  lock_init(&free_map_lock);
   bitmap_mark(free_map, FREE_MAP_SECTOR);
   bitmap_mark(free_map, ROOT_DIR_SECTOR);
+  bitmap_mark(free_map, JOURNAL_SECTOR);
+  rebuild_summary();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The search picks up where the last
+   one left off and wraps around to the start of the disk.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool free_map_allocate(size_t cnt, block_sector_t* sectorp) {
-  block_sector_t sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR && free_map_file != NULL && !bitmap_write(free_map, free_map_file)) {
-    bitmap_set_multiple(free_map, sector, cnt, false);
-    sector = BITMAP_ERROR;
+  size_t sectors = bitmap_size(free_map);
+  size_t sector;
+
+  lock_acquire(&free_map_lock);
+  sector = scan_free_wrap(cursor, sectors, cnt);
+  if (sector != BITMAP_ERROR) {
+    set_sectors(sector, cnt, true);
+    cursor = sector + cnt < sectors ? sector + cnt : 0;
+    *sectorp = sector;
   }
-  if (sector != BITMAP_ERROR)
+  lock_release(&free_map_lock);
+  return sector != BITMAP_ERROR;
+}
+
+/* Allocates CNT consecutive sectors for file data and stores the
+   first into *SECTORP, preferring sectors at or after GOAL in
+   GOAL's block group, outside its inode area.  Falls back to
+   free_map_allocate().
+   Returns true if successful, false if not enough consecutive
+   sectors were available. */
+bool free_map_allocate_near(size_t cnt, block_sector_t goal, block_sector_t* sectorp) {
+  size_t g = goal / GROUP_SECTORS;
+  size_t data_start = g * GROUP_SECTORS + INODE_SECTORS;
+  size_t sector = BITMAP_ERROR;
+
+  lock_acquire(&free_map_lock);
+  if (goal < bitmap_size(free_map) && group_free[g] >= cnt) {
+    if (goal < data_start)
+      goal = data_start;
+    sector = scan_free(goal, group_end(g), cnt);
+    if (sector == BITMAP_ERROR)
+      sector = scan_free(data_start, goal + cnt - 1 < group_end(g) ? goal + cnt - 1 : group_end(g),
+                         cnt);
+  }
+  if (sector != BITMAP_ERROR) {
+    set_sectors(sector, cnt, true);
+    *sectorp = sector;
+  }
+  lock_release(&free_map_lock);
+  return sector != BITMAP_ERROR || free_map_allocate(cnt, sectorp);
+}
+
+/* Allocates a sector for the inode of a new file, or a new
+   directory if DIR is true, in the directory whose inode is in
+   sector PARENT, and stores it into *SECTORP.  A file's inode
+   goes into its parent's block group.  A directory's goes into
+   the group with the most free space, which spreads directories
+   across the disk.  Inode areas are used before the rest of a
+   group and other groups are tried in turn when it is full.
+   Returns true if successful, false if the disk is full. */
+bool free_map_allocate_inode(block_sector_t parent, bool dir, block_sector_t* sectorp) {
+  size_t g = parent / GROUP_SECTORS;
+  size_t sector;
+
+  lock_acquire(&free_map_lock);
+  if (dir) {
+    /* Start past the parent's group so that ties spread out. */
+    size_t best = g;
+    for (size_t i = 1; i <= group_cnt(); i++) {
+      size_t h = (g + i) % group_cnt();
+      if (group_free[h] > group_free[best])
+        best = h;
+    }
+    g = best;
+  }
+
+  sector = scan_free(g * GROUP_SECTORS, g * GROUP_SECTORS + INODE_SECTORS, 1);
+  if (sector == BITMAP_ERROR)
+    sector = scan_free_wrap(g * GROUP_SECTORS, bitmap_size(free_map), 1);
+  if (sector != BITMAP_ERROR) {
+    set_sectors(sector, 1, true);
     *sectorp = sector;
+  }
+  lock_release(&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use, once
+   the journal has committed the running transaction. */
 void free_map_release(block_sector_t sector, size_t cnt) {
+  lock_acquire(&free_map_lock);
   ASSERT(bitmap_all(free_map, sector, cnt));
-  bitmap_set_multiple(free_map, sector, cnt, false);
-  bitmap_write(free_map, free_map_file);
+  set_sectors(sector, cnt, false);
+  bitmap_set_multiple(released, sector, cnt, true);
+  lock_release(&free_map_lock);
+}
+
+/* Notes that the sectors released so far belong to the
+   transaction the journal is about to commit, which must not have
+   any operations in progress.  Called by the journal. */
+void free_map_seal(void) {
+  struct bitmap* b;
+
+  lock_acquire(&free_map_lock);
+  ASSERT(bitmap_none(committing, 0, bitmap_size(committing)));
+  b = committing;
+  committing = released;
+  released = b;
+  lock_release(&free_map_lock);
+}
+
+/* Lets the sectors noted by free_map_seal() be allocated again,
+   now that their transaction is committed.  Called by the
+   journal. */
+void free_map_reclaim(void) {
+  lock_acquire(&free_map_lock);
+  bitmap_set_all(committing, false);
+  lock_release(&free_map_lock);
+}
+
+/* Writes the sectors of the free map file whose bits changed
+   since they were last written.  They reach the buffer cache,
+   which writes them to disk in turn. */
+void free_map_flush(void) {
+  lock_acquire(&free_map_lock);
+  if (free_map_file != NULL) {
+    size_t i = 0;
+    while ((i = bitmap_scan_and_flip(dirty_map, i, 1, true)) != BITMAP_ERROR)
+      if (!bitmap_write_part(free_map, free_map_file, i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        PANIC("can't write free map");
+  }
+  lock_release(&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void free_map_open(void) {
+  lock_acquire(&free_map_lock);
   free_map_file = file_open(inode_open(FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC("can't open free map");
   if (!bitmap_read(free_map, free_map_file))
     PANIC("can't read free map");
+  bitmap_set_all(dirty_map, false);
+  bitmap_set_all(released, false);
+  bitmap_set_all(committing, false);
+  rebuild_summary();
+  cursor = 0;
+  lock_release(&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
-void free_map_close(void) { file_close(free_map_file); }
+void free_map_close(void) {
+  free_map_flush();
+  lock_acquire(&free_map_lock);
+  file_close(free_map_file);
+  free_map_file = NULL;
+  lock_release(&free_map_lock);
+}
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void free_map_create(void) {
   /* Create inode. */
-  if (!inode_create(FREE_MAP_SECTOR, bitmap_file_size(free_map)))
+  if (!inode_create(FREE_MAP_SECTOR, bitmap_file_size(free_map), false))
     PANIC("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open(inode_open(FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The new file is all holes, so writing
+     it allocates its sectors, which takes the lock and changes
+     the map; the sectors that change are rewritten by the next
+     free_map_flush().  The file is published only once written,
+     so that free_map_flush(), which holds the lock while writing,
+     never waits on the file's inode while this holds it. */
+  struct file* file = file_open(inode_open(FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC("can't open free map");
-  if (!bitmap_write(free_map, free_map_file))
+  if (!bitmap_write(free_map, file))
     PANIC("can't write free map");
+  lock_acquire(&free_map_lock);
+  free_map_file = file;
+  lock_release(&free_map_lock);
 }
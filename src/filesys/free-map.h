@@ -10,8 +10,13 @@ void free_map_read(void);
 void free_map_create(void);
 void free_map_open(void);
 void free_map_close(void);
+void free_map_flush(void);
 
 bool free_map_allocate(size_t, block_sector_t*);
+bool free_map_allocate_near(size_t, block_sector_t goal, block_sector_t*);
+bool free_map_allocate_inode(block_sector_t parent, bool dir, block_sector_t*);
 void free_map_release(block_sector_t, size_t);
+void free_map_seal(void);
+void free_map_reclaim(void);
 
 #endif /* filesys/free-map.h */
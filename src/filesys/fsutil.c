@@ -7,6 +7,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -121,7 +122,9 @@ void fsutil_extract(char** argv UNUSED) {
       }
 
       /* Finish up. */
+      journal_begin();
       file_close(dst);
+      journal_end();
     }
   }
 
@@ -1,4 +1,5 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
@@ -6,6 +7,7 @@
 #include "devices/block.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
 /* Identifies an inode. */
@@ -14,166 +16,477 @@
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 
+/* Number of sector pointers in an indirect block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof(block_sector_t))
+
+/* First file sector mapped through the doubly indirect block. */
+#define DOUBLE_INDIRECT_START (NUM_DIRECT + PTRS_PER_SECTOR)
+
+/* Number of extents in an extent leaf block, and the most
+   extents an extent inode can have. */
+#define EXTENTS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof(struct extent))
+#define MAX_EXTENTS (INODE_EXTENTS + PTRS_PER_SECTOR * EXTENTS_PER_SECTOR)
+
+/* Bounds on how many sectors past its growth a file that keeps
+   being appended to has reserved for it. */
+#define PREALLOC_MIN 8
+#define PREALLOC_MAX 64
+
+/* A sector of zeros, which also serves as the block map chunk
+   of an unallocated indirect block. */
+static block_sector_t zeros[PTRS_PER_SECTOR];
+
+/* Format given to newly created inodes. */
+static enum inode_format format = INODE_INDEXED;
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t bytes_to_sectors(off_t size) { return DIV_ROUND_UP(size, BLOCK_SECTOR_SIZE); }
 
-bool inode_resize(struct inode_disk* id, off_t size) {
+/* Allocates a sector, stores it in *SECTORP and zeroes it.
+   ACCESS says whether the sector will hold data or metadata.
+   Returns false if the disk is full. */
+static bool allocate_zeroed(block_sector_t* sectorp, enum cache_access access) {
+  if (!free_map_allocate(1, sectorp))
+    return false;
+  buffer_cache_write(*sectorp, zeros, BLOCK_SECTOR_SIZE, 0, access);
+  return true;
+}
 
-  static char zeros[BLOCK_SECTOR_SIZE];
+/* Gives PA sectors to grow into if it has none left: NEED of
+   them plus PA->extra if that many consecutive sectors are free,
+   otherwise the longest run found by halving the request.  The
+   search starts where the last reservation ended, which keeps
+   the file's data together and in its inode's block group.
+   Returns false if the disk is full. */
+static bool reserve(struct prealloc* pa, size_t need) {
+  size_t cnt = need + pa->extra;
 
-  //Handle Direct Pointers
-  for (int i = 0; i < NUM_DIRECT; i++) {
-    if (size <= BLOCK_SECTOR_SIZE * i && id->direct[i] != 0) {
-      free_map_release(id->direct[i], 1);
-      id->direct[i] = 0;
-    } else if (size > BLOCK_SECTOR_SIZE * i && id->direct[i] == 0) {
-      if (!free_map_allocate(1, &id->direct[i])) {
-        return false;
-      }
-      buffer_cache_write(id->direct[i], zeros, BLOCK_SECTOR_SIZE, 0);
+  if (pa->cnt > 0)
+    return true;
+  while (!free_map_allocate_near(cnt, pa->start, &pa->start)) {
+    if (cnt == 1)
+      return false;
+    cnt /= 2;
+  }
+  pa->cnt = cnt;
+  return true;
+}
+
+/* Allocates a zeroed data sector for a file that still needs
+   NEED more, taking it from PA's reservation, and stores it in
+   *SECTORP.  Returns false if the disk is full. */
+static bool allocate_data(struct prealloc* pa, size_t need, block_sector_t* sectorp) {
+  if (!reserve(pa, need))
+    return false;
+  *sectorp = pa->start++;
+  pa->cnt--;
+  buffer_cache_write(*sectorp, zeros, BLOCK_SECTOR_SIZE, 0, CACHE_DATA);
+  return true;
+}
+
+/* Returns PA's unused sectors to the free map. */
+static void release_prealloc(struct prealloc* pa) {
+  if (pa->cnt > 0)
+    free_map_release(pa->start, pa->cnt);
+  pa->cnt = 0;
+}
+
+/* Returns the IDXth sector pointer in indirect block SECTOR,
+   read in place from the buffer cache, or 0 if SECTOR is 0. */
+static block_sector_t read_pointer(block_sector_t sector, size_t idx) {
+  if (sector == 0)
+    return 0;
+
+  struct buffer_cache_entry* entry = buffer_cache_get(sector, false);
+  block_sector_t ptr = ((block_sector_t*)buffer_cache_data(entry, sector))[idx];
+  buffer_cache_put(entry, sector, false);
+  return ptr;
+}
+
+/* Files may have holes: a data sector whose pointer is 0, or
+   that lies in an extent starting at sector 0, reads as zeros.
+   Growing a file only moves its end; sectors are allocated when
+   they are first written, by fill_holes(). */
+
+/* Releases the data sectors listed in indirect block SECTOR,
+   whose first pointer maps file sector FIRST, that lie at or past
+   file sector END.  The block is updated in place in the buffer
+   cache. */
+static void truncate_indirect(block_sector_t sector, size_t first, size_t end) {
+  struct buffer_cache_entry* entry = buffer_cache_get(sector, true);
+  block_sector_t* ptrs = buffer_cache_data(entry, sector);
+  bool dirty = false;
+
+  for (size_t i = 0; i < PTRS_PER_SECTOR; i++)
+    if (first + i >= end && ptrs[i] != 0) {
+      free_map_release(ptrs[i], 1);
+      ptrs[i] = 0;
+      dirty = true;
     }
+  buffer_cache_put(entry, sector, dirty);
+}
+
+/* Returns pointer IDX of the indirect block in *BLOCKP, first
+   allocating the block if *BLOCKP is 0 and, if the pointer is 0,
+   storing a new sector in it: a data sector from PA for a file
+   that still needs NEED of them, or a zeroed indirect block if
+   PA is null.  Returns 0 if the disk is full. */
+static block_sector_t fill_pointer(block_sector_t* blockp, size_t idx, struct prealloc* pa,
+                                   size_t need) {
+  struct buffer_cache_entry* entry;
+  block_sector_t* ptrs;
+  block_sector_t ptr;
+  bool dirty = false;
+
+  if (*blockp == 0 && !allocate_zeroed(blockp, CACHE_METADATA))
+    return 0;
+  entry = buffer_cache_get(*blockp, true);
+  ptrs = buffer_cache_data(entry, *blockp);
+  ptr = ptrs[idx];
+  if (ptr == 0 &&
+      (pa != NULL ? allocate_data(pa, need, &ptr) : allocate_zeroed(&ptr, CACHE_METADATA))) {
+    ptrs[idx] = ptr;
+    dirty = true;
+  }
+  buffer_cache_put(entry, *blockp, dirty);
+  return ptr;
+}
+
+/* fill_holes() for indexed inodes: allocates data sectors from
+   PA for the holes among file sectors IDX through IDX + CNT - 1
+   of ID.  Returns the number of sectors, from IDX on, that are
+   backed by data sectors afterward. */
+static size_t fill_indexed(struct inode_disk* id, size_t idx, size_t cnt, struct prealloc* pa) {
+  for (size_t i = idx; i < idx + cnt; i++) {
+    size_t need = idx + cnt - i;
+    bool ok;
+
+    if (i < NUM_DIRECT) {
+      ok = id->direct[i] != 0 || allocate_data(pa, need, &id->direct[i]);
+    } else if (i < DOUBLE_INDIRECT_START) {
+      ok = fill_pointer(&id->indirect, i - NUM_DIRECT, pa, need) != 0;
+    } else {
+      size_t j = i - DOUBLE_INDIRECT_START;
+      block_sector_t indirect = fill_pointer(&id->double_indirect, j / PTRS_PER_SECTOR, NULL, 0);
+      ok = indirect != 0 && fill_pointer(&indirect, j % PTRS_PER_SECTOR, pa, need) != 0;
+    }
+    if (!ok)
+      return i - idx;
   }
+  return cnt;
+}
+
+/* inode_resize() for indexed inodes.  Shrinking releases the data
+   sectors past the new end and the indirect blocks that no longer
+   map any. */
+static bool resize_indexed(struct inode_disk* id, off_t size) {
+  size_t end = bytes_to_sectors(size);
 
-  //Check if Indirect Pointers needed
-  if (id->indirect == 0 && size <= NUM_DIRECT * BLOCK_SECTOR_SIZE) {
+  if (size >= id->length) {
     id->length = size;
     return true;
   }
 
-  block_sector_t buffer[128];
-  memset(buffer, 0, 512);
+  for (size_t i = end; i < NUM_DIRECT; i++)
+    if (id->direct[i] != 0) {
+      free_map_release(id->direct[i], 1);
+      id->direct[i] = 0;
+    }
 
-  if (id->indirect == 0) {
-    if (!free_map_allocate(1, &id->indirect)) {
-      return false;
+  if (id->indirect != 0) {
+    truncate_indirect(id->indirect, NUM_DIRECT, end);
+    if (end <= NUM_DIRECT) {
+      free_map_release(id->indirect, 1);
+      id->indirect = 0;
     }
-    buffer_cache_write(id->indirect, zeros, BLOCK_SECTOR_SIZE, 0);
-  } else {
-    buffer_cache_read(id->indirect, buffer, BLOCK_SECTOR_SIZE, 0);
-    //block_read(fs_device, id->indirect, buffer); //TODO?
   }
 
-  //Handle Indirect Pointers
-  for (int i = 0; i < 128; i++) {
-    if (size <= (NUM_DIRECT + i) * BLOCK_SECTOR_SIZE && buffer[i] != 0) {
-      free_map_release(buffer[i], 1);
-      buffer[i] = 0;
-    } else if (size > (NUM_DIRECT + i) * BLOCK_SECTOR_SIZE && buffer[i] == 0) {
-      if (!free_map_allocate(1, &buffer[i])) {
-        return false;
+  if (id->double_indirect != 0) {
+    struct buffer_cache_entry* entry = buffer_cache_get(id->double_indirect, true);
+    block_sector_t* ptrs = buffer_cache_data(entry, id->double_indirect);
+    bool dirty = false;
+
+    for (size_t i = 0; i < PTRS_PER_SECTOR; i++) {
+      size_t first = DOUBLE_INDIRECT_START + PTRS_PER_SECTOR * i;
+      if (ptrs[i] == 0)
+        continue;
+      truncate_indirect(ptrs[i], first, end);
+      if (end <= first) {
+        free_map_release(ptrs[i], 1);
+        ptrs[i] = 0;
+        dirty = true;
       }
-      buffer_cache_write(buffer[i], zeros, BLOCK_SECTOR_SIZE, 0);
+    }
+    buffer_cache_put(entry, id->double_indirect, dirty);
+
+    if (end <= DOUBLE_INDIRECT_START) {
+      free_map_release(id->double_indirect, 1);
+      id->double_indirect = 0;
     }
   }
 
-  buffer_cache_write(id->indirect, buffer, BLOCK_SECTOR_SIZE, 0);
-  //block_write(fs_device, id->indirect, buffer);
+  id->length = size;
+  return true;
+}
+
+/* Extent inodes keep their first INODE_EXTENTS extents in the
+   inode.  The rest live in leaf blocks of EXTENTS_PER_SECTOR
+   extents each, whose sectors are listed in the extent index
+   block.  Holes are extents that start at sector 0. */
 
-  if (size <= NUM_DIRECT * BLOCK_SECTOR_SIZE) {
-    free_map_release(id->indirect, 1);
-    id->indirect = 0;
-    // id->length = size;
-    // return true;
+/* Reads extent IDX of ID into *E. */
+static void get_extent(const struct inode_disk* id, size_t idx, struct extent* e) {
+  if (idx < INODE_EXTENTS) {
+    *e = id->extents[idx];
+    return;
   }
+  idx -= INODE_EXTENTS;
+  block_sector_t leaf = read_pointer(id->extent_index, idx / EXTENTS_PER_SECTOR);
+  buffer_cache_read(leaf, e, sizeof *e, idx % EXTENTS_PER_SECTOR * sizeof *e, CACHE_METADATA);
+}
 
-  //Check if Double Indirect Pointers needed
-  if (id->double_indirect == 0 && size <= (NUM_DIRECT + 128) * BLOCK_SECTOR_SIZE) {
-    id->length = size;
+/* Stores E as extent IDX of ID, allocating the index block and
+   the leaf block that hold it if they do not exist yet.  Returns
+   false if the disk is full. */
+static bool put_extent(struct inode_disk* id, size_t idx, const struct extent* e) {
+  struct buffer_cache_entry* entry;
+  block_sector_t* leaves;
+  block_sector_t leaf;
+
+  if (idx < INODE_EXTENTS) {
+    id->extents[idx] = *e;
     return true;
   }
+  idx -= INODE_EXTENTS;
+
+  if (id->extent_index == 0 && !allocate_zeroed(&id->extent_index, CACHE_METADATA))
+    return false;
+  entry = buffer_cache_get(id->extent_index, true);
+  leaves = buffer_cache_data(entry, id->extent_index);
+  leaf = leaves[idx / EXTENTS_PER_SECTOR];
+  if (leaf == 0 && allocate_zeroed(&leaf, CACHE_METADATA))
+    leaves[idx / EXTENTS_PER_SECTOR] = leaf;
+  buffer_cache_put(entry, id->extent_index, leaf != 0);
+  if (leaf == 0)
+    return false;
+
+  buffer_cache_write(leaf, e, sizeof *e, idx % EXTENTS_PER_SECTOR * sizeof *e, CACHE_METADATA);
+  return true;
+}
 
-  memset(buffer, 0, 512);
-  block_sector_t indirect_buffer[128];
-  memset(indirect_buffer, 0, 512);
+/* Returns true if the CNT sectors starting at START, or a hole if
+   START is 0, directly follow extent E. */
+static bool extends(const struct extent* e, block_sector_t start) {
+  return start == 0 ? e->start == 0 : e->start != 0 && e->start + e->length == start;
+}
 
-  if (id->double_indirect == 0) {
-    if (!free_map_allocate(1, &id->double_indirect)) {
-      return false;
+/* Adds the CNT sectors starting at START, or a hole of CNT
+   sectors if START is 0, to the end of ID's data, growing its
+   last extent if they directly follow it.  Returns false if ID
+   has no room for another extent. */
+static bool append_extent(struct inode_disk* id, block_sector_t start, size_t cnt) {
+  struct extent e;
+
+  if (id->extent_cnt > 0) {
+    get_extent(id, id->extent_cnt - 1, &e);
+    if (extends(&e, start)) {
+      e.length += cnt;
+      return put_extent(id, id->extent_cnt - 1, &e);
     }
-    buffer_cache_write(id->double_indirect, zeros, BLOCK_SECTOR_SIZE, 0);
-  } else {
-    buffer_cache_read(id->double_indirect, buffer, BLOCK_SECTOR_SIZE, 0);
-    //block_read(fs_device, id->double_indirect, buffer);
   }
 
-  for (int i = 0; i < 128; i++) {
-
-    memset(indirect_buffer, 0, 512);
-
-    if (buffer[i] != 0) {
-      //SHRINK. first get indirect block, then free all the direct blocks within indirect block, then free indirect block
-
-      buffer_cache_read(buffer[i], indirect_buffer, BLOCK_SECTOR_SIZE, 0);
-      //block_read(fs_device, buffer[i], indirect_buffer);
+  if (id->extent_cnt == MAX_EXTENTS)
+    return false;
+  e.start = start;
+  e.length = cnt;
+  if (!put_extent(id, id->extent_cnt, &e))
+    return false;
+  id->extent_cnt++;
+  return true;
+}
 
-      for (int j = 0; j < 128; j++) {
-        if (size <= (NUM_DIRECT + 128 + 128 * i + j) * BLOCK_SECTOR_SIZE &&
-            indirect_buffer[j] != 0) {
-          free_map_release(indirect_buffer[j], 1);
-          indirect_buffer[j] = 0;
-        } else if (size > (NUM_DIRECT + 128 + 128 * i + j) * BLOCK_SECTOR_SIZE &&
-                   indirect_buffer[j] == 0) {
-          if (!free_map_allocate(1, &indirect_buffer[j])) {
-            return false;
-          }
-          buffer_cache_write(indirect_buffer[j], zeros, BLOCK_SECTOR_SIZE, 0);
-        }
-      }
+/* Releases the leaf blocks of ID, and its index block, that hold
+   none of its extents. */
+static void trim_extent_blocks(struct inode_disk* id) {
+  struct buffer_cache_entry* entry;
+  block_sector_t* leaves;
+  size_t leaf_cnt;
+  bool dirty = false;
 
-      buffer_cache_write(buffer[i], indirect_buffer, BLOCK_SECTOR_SIZE, 0);
-      //block_write(fs_device, buffer[i], indirect_buffer);
+  if (id->extent_index == 0)
+    return;
 
-      if (size <= (NUM_DIRECT + 128 + 128 * i) * BLOCK_SECTOR_SIZE) {
-        free_map_release(buffer[i], 1);
-        buffer[i] = 0;
-      }
+  entry = buffer_cache_get(id->extent_index, true);
+  leaves = buffer_cache_data(entry, id->extent_index);
+  leaf_cnt = id->extent_cnt > INODE_EXTENTS
+                 ? DIV_ROUND_UP(id->extent_cnt - INODE_EXTENTS, EXTENTS_PER_SECTOR)
+                 : 0;
+  for (size_t i = leaf_cnt; i < PTRS_PER_SECTOR; i++)
+    if (leaves[i] != 0) {
+      free_map_release(leaves[i], 1);
+      leaves[i] = 0;
+      dirty = true;
+    }
+  buffer_cache_put(entry, id->extent_index, dirty);
 
-    } else if (buffer[i] == 0) {
-      //GROW. first allocate indirect block. Then start writing to the direct blocks.
+  if (leaf_cnt == 0) {
+    free_map_release(id->extent_index, 1);
+    id->extent_index = 0;
+  }
+}
 
-      if (size > (NUM_DIRECT + 128 + 128 * i) * BLOCK_SECTOR_SIZE) {
-        if (!free_map_allocate(1, &buffer[i])) {
-          return false;
-        }
-        buffer_cache_write(buffer[i], zeros, BLOCK_SECTOR_SIZE, 0);
-      } else {
-        continue;
+/* Releases every data sector of ID past the first SECTORS, along
+   with the extent blocks that no longer hold any extents. */
+static void truncate_extents(struct inode_disk* id, size_t sectors) {
+  size_t first = 0;
+  size_t cnt = 0;
+
+  for (size_t i = 0; i < id->extent_cnt; i++) {
+    struct extent e;
+
+    get_extent(id, i, &e);
+    if (first >= sectors) {
+      if (e.start != 0)
+        free_map_release(e.start, e.length);
+    } else {
+      cnt = i + 1;
+      if (first + e.length > sectors) {
+        size_t keep = sectors - first;
+        if (e.start != 0)
+          free_map_release(e.start + keep, e.length - keep);
+        e.length = keep;
+        put_extent(id, i, &e);
       }
+    }
+    first += e.length;
+  }
+  id->extent_cnt = cnt;
+  trim_extent_blocks(id);
+}
 
-      for (int j = 0; j < 128; j++) {
-        if (size <= (NUM_DIRECT + 128 + 128 * i + j) * BLOCK_SECTOR_SIZE &&
-            indirect_buffer[j] != 0) {
-          free_map_release(indirect_buffer[j], 1);
-          indirect_buffer[j] = 0;
-        } else if (size > (NUM_DIRECT + 128 + 128 * i + j) * BLOCK_SECTOR_SIZE &&
-                   indirect_buffer[j] == 0) {
-          if (!free_map_allocate(1, &indirect_buffer[j])) {
-            return false;
-          }
-          buffer_cache_write(indirect_buffer[j], zeros, BLOCK_SECTOR_SIZE, 0);
-        }
-      }
+/* fill_holes() for extent inodes: allocates data sectors from PA
+   for up to CNT sectors of the hole that holds file sector IDX of
+   ID, splitting the hole's extent around them.  Returns the
+   number of sectors allocated, which is 0 if the disk is full or
+   ID has no room for the extra extents. */
+static size_t fill_extents(struct inode_disk* id, size_t idx, size_t cnt, struct prealloc* pa) {
+  struct extent hole, prev, pieces[3];
+  size_t first = 0;
+  size_t old_cnt = id->extent_cnt;
+  size_t new_cnt, n = 0;
+  size_t i;
+
+  for (i = 0;; i++) {
+    get_extent(id, i, &hole);
+    if (idx < first + hole.length)
+      break;
+    first += hole.length;
+  }
+  ASSERT(hole.start == 0);
 
-      buffer_cache_write(buffer[i], indirect_buffer, BLOCK_SECTOR_SIZE, 0);
-      //block_write(fs_device, buffer[i], indirect_buffer);
+  if (cnt > first + hole.length - idx)
+    cnt = first + hole.length - idx;
+  if (!reserve(pa, cnt))
+    return 0;
+  if (cnt > pa->cnt)
+    cnt = pa->cnt;
+
+  /* Replace the hole by what comes before the new sectors, the
+     new sectors themselves unless they extend the extent before
+     the hole, and what comes after them. */
+  if (idx > first)
+    pieces[n++] = (struct extent){0, idx - first};
+  else if (i > 0)
+    get_extent(id, i - 1, &prev);
+  bool merge = idx == first && i > 0 && extends(&prev, pa->start);
+  if (!merge)
+    pieces[n++] = (struct extent){pa->start, cnt};
+  if (first + hole.length > idx + cnt)
+    pieces[n++] = (struct extent){0, first + hole.length - (idx + cnt)};
+
+  /* Make room for the pieces, allocating extent blocks up front
+     so that nothing below can fail. */
+  new_cnt = old_cnt + n - 1;
+  if (new_cnt > MAX_EXTENTS)
+    return 0;
+  for (size_t k = old_cnt; k < new_cnt; k++)
+    if (!put_extent(id, k, &hole)) {
+      trim_extent_blocks(id);
+      return 0;
     }
+  if (n > 1) {
+    for (size_t k = old_cnt; k-- > i + 1;) {
+      struct extent e;
+      get_extent(id, k, &e);
+      put_extent(id, k + n - 1, &e);
+    }
+  } else if (n == 0) {
+    for (size_t k = i + 1; k < old_cnt; k++) {
+      struct extent e;
+      get_extent(id, k, &e);
+      put_extent(id, k - 1, &e);
+    }
+  }
+  for (size_t k = 0; k < n; k++)
+    put_extent(id, i + k, &pieces[k]);
+  if (merge) {
+    prev.length += cnt;
+    put_extent(id, i - 1, &prev);
   }
+  id->extent_cnt = new_cnt;
+  if (new_cnt < old_cnt)
+    trim_extent_blocks(id);
+
+  /* Take the sectors from the reservation. */
+  for (size_t k = 0; k < cnt; k++)
+    buffer_cache_write(pa->start + k, zeros, BLOCK_SECTOR_SIZE, 0, CACHE_DATA);
+  pa->start += cnt;
+  pa->cnt -= cnt;
+  return cnt;
+}
 
-  buffer_cache_write(id->double_indirect, buffer, BLOCK_SECTOR_SIZE, 0);
-  //block_write(fs_device, id->double_indirect, buffer);
+/* inode_resize() for extent inodes.  Growing appends a hole. */
+static bool resize_extents(struct inode_disk* id, off_t size) {
+  size_t old_sectors = bytes_to_sectors(id->length);
+  size_t sectors = bytes_to_sectors(size);
 
-  //Check if Double Indirect Pointers needed
-  if (id->double_indirect != 0 && size <= (NUM_DIRECT + 128) * BLOCK_SECTOR_SIZE) {
-    free_map_release(id->double_indirect, 1);
-    id->double_indirect = 0;
-  }
+  if (sectors > old_sectors && !append_extent(id, 0, sectors - old_sectors))
+    return false;
+  if (sectors < old_sectors)
+    truncate_extents(id, sectors);
 
   id->length = size;
   return true;
 }
 
+/* Makes ID a file SIZE bytes long.  New sectors are holes;
+   sectors past the new end are released. */
+bool inode_resize(struct inode_disk* id, off_t size) {
+  if (id->format == INODE_EXTENT)
+    return resize_extents(id, size);
+  else
+    return resize_indexed(id, size);
+}
+
+/* Releases indirect block SECTOR and every data sector it lists. */
+static void dealloc_indirect(block_sector_t sector) {
+  struct buffer_cache_entry* entry = buffer_cache_get(sector, false);
+  block_sector_t* ptrs = buffer_cache_data(entry, sector);
+
+  for (size_t i = 0; i < PTRS_PER_SECTOR; i++)
+    if (ptrs[i] != 0)
+      free_map_release(ptrs[i], 1);
+  buffer_cache_put(entry, sector, false);
+  free_map_release(sector, 1);
+}
+
 bool inode_dealloc(struct inode_disk* id) {
+  if (id->format == INODE_EXTENT) {
+    truncate_extents(id, 0);
+    id->length = 0;
+    return true;
+  }
 
   //Free direct pointers
   for (int i = 0; i < NUM_DIRECT; i++) {
@@ -183,162 +496,360 @@ bool inode_dealloc(struct inode_disk* id) {
     }
   }
 
-  block_sector_t buffer[128];
-  memset(buffer, 0, 512);
-
   //Free indirect pointers
   if (id->indirect != 0) {
-    buffer_cache_read(id->indirect, buffer, BLOCK_SECTOR_SIZE, 0);
-    //block_read(fs_device, id->indirect, buffer);
-
-    for (int i = 0; i < 128; i++) {
-      if (buffer[i] != 0) {
-        free_map_release(buffer[i], 1);
-        buffer[i] = 0;
-      }
-    }
+    dealloc_indirect(id->indirect);
+    id->indirect = 0;
   }
 
-  memset(buffer, 0, 512);
-  block_sector_t double_buffer[128];
-  memset(double_buffer, 0, 512);
-
   //Free Double Indirect Pointers
   if (id->double_indirect != 0) {
+    struct buffer_cache_entry* entry = buffer_cache_get(id->double_indirect, false);
+    block_sector_t* ptrs = buffer_cache_data(entry, id->double_indirect);
 
-    buffer_cache_read(id->double_indirect, buffer, BLOCK_SECTOR_SIZE, 0);
-    //block_read(fs_device, id->double_indirect, buffer);
-
-    for (int i = 0; i < 128; i++) {
-      if (buffer[i] != 0) {
-
-        buffer_cache_read(buffer[i], double_buffer, BLOCK_SECTOR_SIZE, 0);
-        //block_read(fs_device, buffer[i], double_buffer);
-
-        for (int j = 0; j < 128; j++) {
-          if (double_buffer[j] != 0) {
-            free_map_release(double_buffer[j], 1);
-            double_buffer[j] = 0;
-          }
-        }
-
-        free_map_release(buffer[i], 1);
-        buffer[i] = 0;
-      }
-    }
-  }
-
-  //Check if Double Indirect Pointers needed
-  if (id->double_indirect != 0) {
+    for (size_t i = 0; i < PTRS_PER_SECTOR; i++)
+      if (ptrs[i] != 0)
+        dealloc_indirect(ptrs[i]);
+    buffer_cache_put(entry, id->double_indirect, false);
     free_map_release(id->double_indirect, 1);
     id->double_indirect = 0;
   }
 
-  //Check if Double Indirect Pointers needed
-  if (id->indirect != 0) {
-    free_map_release(id->indirect, 1);
-    id->indirect = 0;
-  }
-
   id->length = 0;
 
   return true;
 }
 
-/* In-memory inode. */
-
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
+   within INODE_DISK (id).
+   Returns -1 if INODE_DISK(id) does not contain data for a byte at offset
    POS. */
-static block_sector_t byte_to_sector(const struct inode* inode, off_t pos) {
-  ASSERT(inode != NULL);
+static block_sector_t byte_to_sector_inode_disk(const struct inode_disk* id, off_t pos) {
+  ASSERT(id != NULL);
 
-  int sector_num = pos / BLOCK_SECTOR_SIZE;
-  if (pos >= inode->data.length || pos < 0) {
+  size_t sector_num = pos / BLOCK_SECTOR_SIZE;
+  if (pos >= id->length || pos < 0) {
     return -1;
   }
 
-  if (sector_num < NUM_DIRECT) {
-    return inode->data.direct[sector_num];
+  if (id->format == INODE_EXTENT) {
+    for (size_t i = 0;; i++) {
+      struct extent e;
+      get_extent(id, i, &e);
+      if (sector_num < e.length)
+        return e.start != 0 ? e.start + sector_num : 0;
+      sector_num -= e.length;
+    }
+  } else if (sector_num < NUM_DIRECT) {
+    return id->direct[sector_num];
+  } else if (sector_num < DOUBLE_INDIRECT_START) {
+    return read_pointer(id->indirect, sector_num - NUM_DIRECT);
+  } else {
+    /* Find the indirect block in the doubly indirect block, then
+       the data sector in the indirect block. */
+    sector_num -= DOUBLE_INDIRECT_START;
+    block_sector_t indirect = read_pointer(id->double_indirect, sector_num / PTRS_PER_SECTOR);
+    return read_pointer(indirect, sector_num % PTRS_PER_SECTOR);
+  }
+}
+
+/* In-memory inode. */
 
-  } else if (sector_num < NUM_DIRECT + 128) {
-    //Read in indirect block and return the block sector of the right one
-    block_sector_t buffer[128];
-    memset(buffer, 0, BLOCK_SECTOR_SIZE);
-    buffer_cache_read(inode->data.indirect, buffer, BLOCK_SECTOR_SIZE, 0);
-    return buffer[sector_num - NUM_DIRECT];
+/* An open inode caches copies of its indirect blocks, so that
+   mapping file sectors to device sectors does not go back to the
+   buffer cache for every sector.  Chunk 0 is the indirect block,
+   chunk 1 the doubly indirect block and chunk 2 + I the Ith
+   indirect block below it. */
+#define MAP_CHUNKS (2 + PTRS_PER_SECTOR)
+
+/* Returns the cached copy of chunk N of INODE's block map,
+   reading it in if necessary, or all zeros if the chunk is not
+   allocated.  Returns a null pointer if memory is short.  INODE's
+   map_lock must be held. */
+static const block_sector_t* map_chunk(struct inode* inode, size_t n) {
+  block_sector_t sector;
+
+  if (inode->map == NULL) {
+    inode->map = calloc(MAP_CHUNKS, sizeof *inode->map);
+    if (inode->map == NULL)
+      return NULL;
+  }
+  if (inode->map[n] != NULL)
+    return inode->map[n];
 
+  if (n == 0) {
+    sector = inode->data.indirect;
+  } else if (n == 1) {
+    sector = inode->data.double_indirect;
   } else {
-    /*First read in double indirect block. Then figure out which indirect block to find and read that in. 
-    Finally, return the sector for the direct block. */
-    block_sector_t buffer[128];
-    memset(buffer, 0, BLOCK_SECTOR_SIZE);
-    buffer_cache_read(inode->data.double_indirect, buffer, BLOCK_SECTOR_SIZE, 0);
+    const block_sector_t* parent = map_chunk(inode, 1);
+    if (parent == NULL)
+      return NULL;
+    sector = parent[n - 2];
+  }
+  if (sector == 0)
+    return zeros;
+
+  inode->map[n] = malloc(BLOCK_SECTOR_SIZE);
+  if (inode->map[n] != NULL)
+    buffer_cache_read(sector, inode->map[n], BLOCK_SECTOR_SIZE, 0, CACHE_METADATA);
+  return inode->map[n];
+}
 
-    //find the indirect block needed
-    block_sector_t indirect_buffer[128];
-    memset(indirect_buffer, 0, BLOCK_SECTOR_SIZE);
-    int indirect_pos = (sector_num - NUM_DIRECT - 128) / 128;
+/* An extent of an open extent inode, with its place in the file. */
+struct extent_run {
+  size_t first;         /* First file sector in the extent. */
+  block_sector_t start; /* First device sector. */
+  size_t length;        /* Number of sectors. */
+};
+
+/* Returns the cached copy of extent inode INODE's extents,
+   reading them in if necessary.  Returns a null pointer if memory
+   is short.  INODE's map_lock must be held. */
+static struct extent_run* extent_runs(struct inode* inode) {
+  const struct inode_disk* id = &inode->data;
+  size_t first = 0;
+
+  if (inode->runs != NULL)
+    return inode->runs;
+  inode->runs = malloc(id->extent_cnt * sizeof *inode->runs);
+  if (inode->runs == NULL)
+    return NULL;
 
-    buffer_cache_read(buffer[indirect_pos], indirect_buffer, BLOCK_SECTOR_SIZE, 0);
-    return indirect_buffer[(sector_num - NUM_DIRECT - 128) % 128];
+  for (size_t i = 0; i < id->extent_cnt;) {
+    struct buffer_cache_entry* entry = NULL;
+    const struct extent* extents;
+    block_sector_t leaf = 0;
+    size_t cnt;
+
+    /* Copy the extents in the inode, or a whole leaf at once. */
+    if (i < INODE_EXTENTS) {
+      extents = id->extents;
+      cnt = INODE_EXTENTS;
+    } else {
+      leaf = read_pointer(id->extent_index, (i - INODE_EXTENTS) / EXTENTS_PER_SECTOR);
+      entry = buffer_cache_get(leaf, false);
+      extents = buffer_cache_data(entry, leaf);
+      cnt = EXTENTS_PER_SECTOR;
+    }
+    for (size_t j = 0; j < cnt && i < id->extent_cnt; i++, j++) {
+      inode->runs[i].first = first;
+      inode->runs[i].start = extents[j].start;
+      inode->runs[i].length = extents[j].length;
+      first += extents[j].length;
+    }
+    if (entry != NULL)
+      buffer_cache_put(entry, leaf, false);
   }
+  return inode->runs;
 }
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE_DISK (id).
-   Returns -1 if INODE_DISK(id) does not contain data for a byte at offset
-   POS. 
-   This is different from byte_to_sector as this takes in an inode_disk struct */
-static block_sector_t byte_to_sector_inode_disk(struct inode_disk* id, off_t pos) {
-  ASSERT(id != NULL);
+/* Returns the extent of INODE that holds file sector IDX, found
+   by binary search in RUNS. */
+static const struct extent_run* find_run(const struct inode* inode,
+                                         const struct extent_run* runs, size_t idx) {
+  size_t lo = 0;
+  size_t hi = inode->data.extent_cnt;
+
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (runs[mid].first <= idx)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return &runs[lo];
+}
 
-  int sector_num = pos / BLOCK_SECTOR_SIZE;
-  if (pos >= id->length || pos < 0) {
-    return -1;
+/* Marks INODE as changed, so that it is written back when flushed
+   or closed, and tells the journal the next commit will log it.
+   INODE's rw_lock must be held for writing. */
+static void set_dirty(struct inode* inode) {
+  if (!inode->dirty) {
+    inode->dirty = true;
+    journal_defer();
+  }
+}
+
+/* Drops INODE's cached block map.  Must be called whenever
+   INODE's sector pointers change. */
+static void map_invalidate(struct inode* inode) {
+  lock_acquire(&inode->map_lock);
+  if (inode->map != NULL) {
+    for (size_t i = 0; i < MAP_CHUNKS; i++)
+      free(inode->map[i]);
+    free(inode->map);
+    inode->map = NULL;
   }
+  free(inode->runs);
+  inode->runs = NULL;
+  lock_release(&inode->map_lock);
+}
 
-  if (sector_num < NUM_DIRECT) {
-    return id->direct[sector_num];
+/* map_run() for extent inodes. */
+static block_sector_t map_extents(struct inode* inode, size_t idx, size_t sectors, size_t* cntp) {
+  const struct extent_run* runs = extent_runs(inode);
 
-  } else if (sector_num < NUM_DIRECT + 128) {
-    //Read in indirect block and return the block sector of the right one
-    block_sector_t buffer[128];
-    memset(buffer, 0, BLOCK_SECTOR_SIZE);
-    buffer_cache_read(id->indirect, buffer, BLOCK_SECTOR_SIZE, 0);
-    return buffer[sector_num - NUM_DIRECT];
+  if (runs != NULL) {
+    const struct extent_run* run = find_run(inode, runs, idx);
+    size_t end = run->first + run->length;
 
+    *cntp = (end < sectors ? end : sectors) - idx;
+    return run->start != 0 ? run->start + (idx - run->first) : 0;
+  }
+
+  /* Out of memory: look the sector up without the map. */
+  *cntp = 1;
+  return byte_to_sector_inode_disk(&inode->data, idx * BLOCK_SECTOR_SIZE);
+}
+
+/* map_run() for indexed inodes. */
+static block_sector_t map_indexed(struct inode* inode, size_t idx, size_t sectors, size_t* cntp) {
+  const block_sector_t* ptrs;
+  size_t first, end;
+  block_sector_t sector;
+  size_t cnt = 1;
+
+  if (idx < NUM_DIRECT) {
+    ptrs = inode->data.direct;
+    first = 0;
+    end = NUM_DIRECT;
+  } else if (idx < DOUBLE_INDIRECT_START) {
+    ptrs = map_chunk(inode, 0);
+    first = NUM_DIRECT;
+    end = DOUBLE_INDIRECT_START;
   } else {
-    /*First read in double indirect block. Then figure out which indirect block to find and read that in. 
-    Finally, return the sector for the direct block. */
-    block_sector_t buffer[128];
-    memset(buffer, 0, BLOCK_SECTOR_SIZE);
-    buffer_cache_read(id->double_indirect, buffer, BLOCK_SECTOR_SIZE, 0);
+    size_t i = (idx - DOUBLE_INDIRECT_START) / PTRS_PER_SECTOR;
+    ptrs = map_chunk(inode, 2 + i);
+    first = DOUBLE_INDIRECT_START + i * PTRS_PER_SECTOR;
+    end = first + PTRS_PER_SECTOR;
+  }
 
-    //find the indirect block needed
-    block_sector_t indirect_buffer[128];
-    memset(indirect_buffer, 0, BLOCK_SECTOR_SIZE);
-    int indirect_pos = (sector_num - NUM_DIRECT - 128) / 128;
+  if (ptrs != NULL) {
+    if (end > sectors)
+      end = sectors;
+    sector = ptrs[idx - first];
+    while (idx + cnt < end && ptrs[idx + cnt - first] == (sector != 0 ? sector + cnt : 0))
+      cnt++;
+  } else {
+    /* Out of memory: look the sector up without the map. */
+    sector = byte_to_sector_inode_disk(&inode->data, idx * BLOCK_SECTOR_SIZE);
+  }
 
-    buffer_cache_read(buffer[indirect_pos], indirect_buffer, BLOCK_SECTOR_SIZE, 0);
-    return indirect_buffer[(sector_num - NUM_DIRECT - 128) % 128];
+  *cntp = cnt;
+  return sector;
+}
+
+/* Returns the device sector that holds file sector IDX of INODE,
+   0 if IDX lies in a hole, or -1 if IDX is past end of file, and
+   stores in *CNTP the number of file sectors, starting with IDX,
+   that lie in consecutive device sectors or in the same hole. */
+static block_sector_t map_run(struct inode* inode, size_t idx, size_t* cntp) {
+  size_t sectors = bytes_to_sectors(inode->data.length);
+  block_sector_t sector;
+
+  if (idx >= sectors)
+    return -1;
+
+  lock_acquire(&inode->map_lock);
+  if (inode->data.format == INODE_EXTENT)
+    sector = map_extents(inode, idx, sectors, cntp);
+  else
+    sector = map_indexed(inode, idx, sectors, cntp);
+  lock_release(&inode->map_lock);
+  return sector;
+}
+
+/* Returns the block device sector that contains byte offset POS
+   within INODE.
+   Returns -1 if INODE does not contain data for a byte at offset
+   POS. */
+static block_sector_t byte_to_sector(struct inode* inode, off_t pos) {
+  size_t cnt;
+
+  ASSERT(inode != NULL);
+  if (pos < 0)
+    return -1;
+  return map_run(inode, pos / BLOCK_SECTOR_SIZE, &cnt);
+}
+
+/* Allocates data sectors for the holes among file sectors START
+   through END - 1 of INODE, taking them from INODE's growth
+   reservation.  Returns false if the disk is full. */
+static bool fill_holes(struct inode* inode, size_t start, size_t end) {
+  size_t idx = start;
+
+  while (idx < end) {
+    size_t cnt;
+    block_sector_t sector = map_run(inode, idx, &cnt);
+
+    if (cnt > end - idx)
+      cnt = end - idx;
+    if (sector == 0) {
+      set_dirty(inode);
+      if (inode->data.format == INODE_EXTENT)
+        cnt = fill_extents(&inode->data, idx, cnt, &inode->prealloc);
+      else
+        cnt = fill_indexed(&inode->data, idx, cnt, &inode->prealloc);
+      map_invalidate(inode);
+      if (cnt == 0)
+        return false;
+    }
+    idx += cnt;
   }
+  return true;
+}
+
+/* Returns how the buffer cache should count and journal accesses
+   to INODE's contents: directories, their indexes and the free
+   map are metadata. */
+static enum cache_access contents_access(const struct inode* inode) {
+  return inode->data.dir || inode->data.index || inode->sector == FREE_MAP_SECTOR
+             ? CACHE_METADATA
+             : CACHE_DATA;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, indexed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  OPEN_INODES_LOCK
+   protects the table and the open counts and LOADED flags of the
+   inodes in it.  It is never held across disk or buffer cache
+   access: an inode enters the table before it is read and leaves
+   only after its last close has written it back, and openers that
+   find it meanwhile wait on INODE_SETTLED. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+static struct condition inode_settled; /* Broadcast when an inode is loaded or leaves. */
+
+/* Returns a hash value for inode E's sector. */
+static unsigned inode_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_int(hash_entry(e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool inode_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  return hash_entry(a, struct inode, elem)->sector < hash_entry(b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
-void inode_init(void) { list_init(&open_inodes); }
+void inode_init(void) {
+  if (!hash_init(&open_inodes, inode_hash, inode_less, NULL))
+    PANIC("open inode table creation failed");
+  lock_init(&open_inodes_lock);
+  cond_init(&inode_settled);
+}
+
+/* Makes inodes created from now on use FORMAT_. */
+void inode_set_format(enum inode_format format_) { format = format_; }
+
+/* Returns INODE's format. */
+enum inode_format inode_get_format(const struct inode* inode) { return inode->data.format; }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The inode is a directory if DIR is true.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
-bool inode_create(block_sector_t sector, off_t length) {
+bool inode_create(block_sector_t sector, off_t length, bool dir) {
   struct inode_disk* disk_inode = NULL;
   bool success = false;
 
@@ -350,7 +861,6 @@ bool inode_create(block_sector_t sector, off_t length) {
 
   disk_inode = calloc(1, sizeof *disk_inode);
   if (disk_inode != NULL) {
-    size_t sectors = bytes_to_sectors(length);
     //initializing the data pointers for inode to all be 0
     for (int i = 0; i < NUM_DIRECT; i++) {
       disk_inode->direct[i] = 0;
@@ -359,6 +869,8 @@ bool inode_create(block_sector_t sector, off_t length) {
     disk_inode->double_indirect = 0;
     disk_inode->length = 0;
     disk_inode->magic = INODE_MAGIC;
+    disk_inode->format = format;
+    disk_inode->dir = dir;
 
     if (!inode_resize(disk_inode, length)) {
       free(disk_inode);
@@ -371,13 +883,7 @@ bool inode_create(block_sector_t sector, off_t length) {
     }
     free(dummy);
 
-    static char zeros[BLOCK_SECTOR_SIZE];
-    for (size_t i = 0; i < sectors; i++) {
-      block_sector_t temp_block = byte_to_sector_inode_disk(disk_inode, i * BLOCK_SECTOR_SIZE);
-      buffer_cache_write(temp_block, zeros, BLOCK_SECTOR_SIZE, 0);
-    }
-
-    buffer_cache_write(sector, disk_inode, BLOCK_SECTOR_SIZE, 0);
+    buffer_cache_write(sector, disk_inode, BLOCK_SECTOR_SIZE, 0, CACHE_METADATA);
     success = true;
 
     free(disk_inode);
@@ -389,38 +895,70 @@ bool inode_create(block_sector_t sector, off_t length) {
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode* inode_open(block_sector_t sector) {
-  struct list_elem* e;
+  struct inode key;
+  struct hash_elem* e;
   struct inode* inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin(&open_inodes); e != list_end(&open_inodes); e = list_next(e)) {
-    inode = list_entry(e, struct inode, elem);
-    if (inode->sector == sector) {
-      inode_reopen(inode);
+  /* Check whether this inode is already open.  One that is being
+     closed is waited out; one that is being read is waited for. */
+  lock_acquire(&open_inodes_lock);
+  key.sector = sector;
+  while ((e = hash_find(&open_inodes, &key.elem)) != NULL) {
+    inode = hash_entry(e, struct inode, elem);
+    if (inode->open_cnt > 0) {
+      inode->open_cnt++;
+      while (!inode->loaded)
+        cond_wait(&inode_settled, &open_inodes_lock);
+      lock_release(&open_inodes_lock);
       return inode;
     }
+    cond_wait(&inode_settled, &open_inodes_lock);
   }
 
   /* Allocate memory. */
   inode = malloc(sizeof *inode);
-  if (inode == NULL)
+  if (inode == NULL) {
+    lock_release(&open_inodes_lock);
     return NULL;
+  }
 
-  /* Initialize. */
-  list_push_front(&open_inodes, &inode->elem);
+  /* Initialize.  The inode goes into the table unloaded, so that
+     concurrent openers wait for it instead of reading it again. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loaded = false;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->dirty = false;
+  rw_lock_init(&inode->rw_lock);
+  rw_lock_init(&inode->dir_lock);
+  inode->dir_free = 0;
+  inode->dir_freed = 0;
+  lock_init(&inode->map_lock);
+  inode->map = NULL;
+  inode->runs = NULL;
+  inode->prealloc.start = sector + 1;
+  inode->prealloc.cnt = 0;
+  inode->prealloc.extra = 0;
+  hash_insert(&open_inodes, &inode->elem);
+  lock_release(&open_inodes_lock);
+
   //block_read(fs_device, inode->sector, &inode->data);
-  buffer_cache_read(inode->sector, &inode->data, BLOCK_SECTOR_SIZE, 0);
+  buffer_cache_read(inode->sector, &inode->data, BLOCK_SECTOR_SIZE, 0, CACHE_METADATA);
+  lock_acquire(&open_inodes_lock);
+  inode->loaded = true;
+  cond_broadcast(&inode_settled, &open_inodes_lock);
+  lock_release(&open_inodes_lock);
   return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode* inode_reopen(struct inode* inode) {
-  if (inode != NULL)
+  if (inode != NULL) {
+    lock_acquire(&open_inodes_lock);
     inode->open_cnt++;
+    lock_release(&open_inodes_lock);
+  }
   return inode;
 }
 
@@ -435,10 +973,25 @@ void inode_close(struct inode* inode) {
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0) {
-    /* Remove from inode list and release lock. */
-    list_remove(&inode->elem);
+  /* Release resources if this was the last opener.  The inode
+     is written back before it leaves the table, so that reopening
+     it never reads a stale copy; openers that find it with no
+     openers wait until it is gone.  Once it is out of the table no
+     one else can reach it, so the rest of the work needs no lock. */
+  lock_acquire(&open_inodes_lock);
+  bool last = --inode->open_cnt == 0;
+  lock_release(&open_inodes_lock);
+
+  if (last) {
+    if (inode->dirty && !inode->removed)
+      buffer_cache_write(inode->sector, &inode->data, BLOCK_SECTOR_SIZE, 0, CACHE_METADATA);
+    lock_acquire(&open_inodes_lock);
+    hash_delete(&open_inodes, &inode->elem);
+    cond_broadcast(&inode_settled, &open_inodes_lock);
+    lock_release(&open_inodes_lock);
+
+    /* Return sectors reserved for growth. */
+    release_prealloc(&inode->prealloc);
 
     /* Deallocate blocks if removed. */
     if (inode->removed) {
@@ -446,10 +999,55 @@ void inode_close(struct inode* inode) {
       free_map_release(inode->sector, 1);
     }
 
+    map_invalidate(inode);
     free(inode); // TODO: PROB SOME OOM STUFF HERE
   }
 }
 
+/* Inodes gathered by inode_flush_all(), under
+   OPEN_INODES_LOCK. */
+static struct list flush_list;
+
+/* Adds inode E to FLUSH_LIST, holding it open, if it is loaded and
+   has changed.  Inodes with no openers left are written back by
+   their last closer. */
+static void gather_inode(struct hash_elem* e, void* aux UNUSED) {
+  struct inode* inode = hash_entry(e, struct inode, elem);
+
+  if (inode->open_cnt > 0 && inode->loaded && inode->dirty) {
+    inode->open_cnt++;
+    list_push_back(&flush_list, &inode->flush_elem);
+  }
+}
+
+/* Writes every open inode that has changed back to disk.  Writes
+   only mark an inode dirty; it reaches the buffer cache here or
+   when its last opener closes it.  The inodes are gathered and
+   held open under OPEN_INODES_LOCK, then written without it. */
+void inode_flush_all(void) {
+  struct list inodes;
+
+  list_init(&inodes);
+  lock_acquire(&open_inodes_lock);
+  list_init(&flush_list);
+  hash_apply(&open_inodes, gather_inode);
+  while (!list_empty(&flush_list))
+    list_push_back(&inodes, list_pop_front(&flush_list));
+  lock_release(&open_inodes_lock);
+
+  while (!list_empty(&inodes)) {
+    struct inode* inode = list_entry(list_pop_front(&inodes), struct inode, flush_elem);
+
+    rw_lock_acquire(&inode->rw_lock, true);
+    if (inode->dirty && !inode->removed) {
+      buffer_cache_write(inode->sector, &inode->data, BLOCK_SECTOR_SIZE, 0, CACHE_METADATA);
+      inode->dirty = false;
+    }
+    rw_lock_release(&inode->rw_lock, true);
+    inode_close(inode);
+  }
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void inode_remove(struct inode* inode) {
@@ -457,9 +1055,13 @@ void inode_remove(struct inode* inode) {
   ASSERT(inode != NULL);
   inode->removed = true;
   if (inode->open_cnt == 0) {
-    list_remove(&inode->elem);
+    lock_acquire(&open_inodes_lock);
+    hash_delete(&open_inodes, &inode->elem);
+    lock_release(&open_inodes_lock);
+    release_prealloc(&inode->prealloc);
     inode_dealloc(&inode->data);
     free_map_release(inode->sector, 1);
+    map_invalidate(inode);
     free(inode); // TODO: PROB SOME OOM STUFF HERE
   }
 }
@@ -470,12 +1072,20 @@ void inode_remove(struct inode* inode) {
 off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset) {
   uint8_t* buffer = buffer_;
   off_t bytes_read = 0;
+  block_sector_t run_sector = 0; /* Next sector of the current run. */
+  size_t run_left = 0;           /* Sectors left in the current run. */
   //uint8_t* bounce = NULL;
 
+  rw_lock_acquire(&inode->rw_lock, true);
   while (size > 0) {
     /* Disk sector to read, starting byte offset within sector. */
-    block_sector_t sector_idx = byte_to_sector(inode, offset);
+    if (run_left == 0)
+      run_sector = map_run(inode, offset / BLOCK_SECTOR_SIZE, &run_left);
+    block_sector_t sector_idx = run_sector;
     int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+    if (run_sector != 0)
+      run_sector++;
+    run_left--;
 
     /* Bytes left in inode, bytes left in sector, lesser of the two. */
     off_t inode_left = inode_length(inode) - offset;
@@ -488,7 +1098,11 @@ off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset
       break;
     }
 
-    buffer_cache_read(sector_idx, buffer + bytes_read, chunk_size, sector_ofs);
+    if (sector_idx != 0)
+      buffer_cache_read(sector_idx, buffer + bytes_read, chunk_size, sector_ofs,
+                        contents_access(inode));
+    else
+      memset(buffer + bytes_read, 0, chunk_size);
     //block_read(fs_device, sector_idx, buffer_);
 
     //if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
@@ -511,6 +1125,7 @@ off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset
     offset += chunk_size;
     bytes_read += chunk_size;
   }
+  rw_lock_release(&inode->rw_lock, true);
   //free(bounce);
 
   if (bytes_read == 0) {
@@ -520,6 +1135,40 @@ off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset
   return bytes_read;
 }
 
+/* Asks the buffer cache to prefetch the sectors of INODE that
+   hold the SIZE bytes starting at OFFSET, stopping at end of
+   file.  Does not wait for the reads. */
+void inode_readahead(struct inode* inode, off_t offset, off_t size) {
+  size_t idx = offset / BLOCK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors(offset + size);
+  size_t cnt;
+
+  rw_lock_acquire(&inode->rw_lock, true);
+  while (idx < end) {
+    block_sector_t sector = map_run(inode, idx, &cnt);
+    if (sector == (block_sector_t)-1)
+      break;
+    for (size_t i = 0; i < cnt && idx < end; i++, idx++)
+      if (sector != 0)
+        buffer_cache_prefetch(sector + i);
+  }
+  rw_lock_release(&inode->rw_lock, true);
+}
+
+/* Returns the buffer cache entry holding the sector of INODE
+   that contains byte offset POS, obtained with
+   buffer_cache_get() so that it can be used in place, and stores
+   the sector in *SECTORP.  Returns a null pointer if POS is past
+   end of file, or lies in a hole, in which case *SECTORP is 0. */
+struct buffer_cache_entry* inode_get_block(struct inode* inode, off_t pos, bool exclusive,
+                                           block_sector_t* sectorp) {
+  rw_lock_acquire(&inode->rw_lock, true);
+  *sectorp = byte_to_sector(inode, pos);
+  rw_lock_release(&inode->rw_lock, true);
+  return *sectorp != (block_sector_t)-1 && *sectorp != 0 ? buffer_cache_get(*sectorp, exclusive)
+                                                         : NULL;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
@@ -528,23 +1177,54 @@ off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset
 off_t inode_write_at(struct inode* inode, const void* buffer_, off_t size, off_t offset) {
   const uint8_t* buffer = buffer_;
   off_t bytes_written = 0;
+  block_sector_t run_sector = 0; /* Next sector of the current run. */
+  size_t run_left = 0;           /* Sectors left in the current run. */
   //uint8_t* bounce = NULL;
+  off_t old_length;
+
+  rw_lock_acquire(&inode->rw_lock, false);
+  if (inode->deny_write_cnt)
+    goto done;
+
+  old_length = inode->data.length;
   //msg("ASDASDASDASDASDAS, %d\n", inode->data.direct[0]);
   if (offset + size > inode->data.length) {
-    if (!inode_resize(&inode->data, size + offset)) {
-      return 0;
-    }
+    /* Reserve more and more past what appends need; growth that
+       leaves a gap is not speculated on. */
+    struct prealloc* pa = &inode->prealloc;
+    if (offset > inode->data.length)
+      pa->extra = 0;
+    else if (pa->extra == 0)
+      pa->extra = PREALLOC_MIN;
+    else if (pa->extra < PREALLOC_MAX)
+      pa->extra *= 2;
+
+    bool resized = inode_resize(&inode->data, size + offset);
+    set_dirty(inode);
+    map_invalidate(inode);
+    if (!resized)
+      goto done;
   }
 
   //msg("ASDASDASDASDASDAS, %d\n", inode->data.direct[0]);
 
-  if (inode->deny_write_cnt)
-    return 0;
+  /* Allocate the sectors about to be written, undoing the growth
+     if the disk is full. */
+  if (size > 0 && !fill_holes(inode, offset / BLOCK_SECTOR_SIZE, bytes_to_sectors(offset + size))) {
+    if (inode->data.length > old_length) {
+      inode_resize(&inode->data, old_length);
+      map_invalidate(inode);
+    }
+    goto done;
+  }
 
   while (size > 0) {
     /* Sector to write, starting byte offset within sector. */
-    block_sector_t sector_idx = byte_to_sector(inode, offset);
+    if (run_left == 0)
+      run_sector = map_run(inode, offset / BLOCK_SECTOR_SIZE, &run_left);
+    block_sector_t sector_idx = run_sector++;
     int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+    run_left--;
 
     /* Bytes left in inode, bytes left in sector, lesser of the two. */
     off_t inode_left = inode_length(inode) - offset;
@@ -556,7 +1236,8 @@ off_t inode_write_at(struct inode* inode, const void* buffer_, off_t size, off_t
     if (chunk_size <= 0)
       break;
 
-    buffer_cache_write(sector_idx, buffer + bytes_written, chunk_size, sector_ofs);
+    buffer_cache_write(sector_idx, buffer + bytes_written, chunk_size, sector_ofs,
+                       contents_access(inode));
     //if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
     /* Write full sector directly to disk. */
     //  block_write(fs_device, sector_idx, buffer + bytes_written);
@@ -586,25 +1267,82 @@ off_t inode_write_at(struct inode* inode, const void* buffer_, off_t size, off_t
   }
   //free(bounce);
 
-  buffer_cache_write(inode->sector, &inode->data, BLOCK_SECTOR_SIZE, 0);
-
+done:
+  rw_lock_release(&inode->rw_lock, false);
   return bytes_written;
 }
 
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void inode_deny_write(struct inode* inode) {
+  rw_lock_acquire(&inode->rw_lock, false);
   inode->deny_write_cnt++;
   ASSERT(inode->deny_write_cnt <= inode->open_cnt);
+  rw_lock_release(&inode->rw_lock, false);
 }
 
 /* Re-enables writes to INODE.
    Must be called once by each inode opener who has called
    inode_deny_write() on the inode, before closing the inode. */
 void inode_allow_write(struct inode* inode) {
+  rw_lock_acquire(&inode->rw_lock, false);
   ASSERT(inode->deny_write_cnt > 0);
   ASSERT(inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rw_lock_release(&inode->rw_lock, false);
+}
+
+/* Locks directory INODE, shared to look up or read its entries if
+   READER is true, otherwise exclusively to change its entries or
+   index. */
+void inode_lock_dir(struct inode* inode, bool reader) {
+  rw_lock_acquire(&inode->dir_lock, reader);
+}
+
+/* Unlocks directory INODE, locked by inode_lock_dir(). */
+void inode_unlock_dir(struct inode* inode, bool reader) {
+  rw_lock_release(&inode->dir_lock, reader);
+}
+
+/* Returns the sector of directory INODE's hash index, or 0 if it
+   has none. */
+block_sector_t inode_get_index(struct inode* inode) {
+  rw_lock_acquire(&inode->rw_lock, true);
+  block_sector_t sector = inode->data.dir_index;
+  rw_lock_release(&inode->rw_lock, true);
+  return sector;
+}
+
+/* Makes the inode in SECTOR directory INODE's hash index, or
+   removes its index if SECTOR is 0. */
+void inode_set_index(struct inode* inode, block_sector_t sector) {
+  rw_lock_acquire(&inode->rw_lock, false);
+  inode->data.dir_index = sector;
+  set_dirty(inode);
+  rw_lock_release(&inode->rw_lock, false);
+}
+
+/* Marks INODE as a directory's hash index, whose contents are
+   metadata. */
+void inode_mark_index(struct inode* inode) {
+  rw_lock_acquire(&inode->rw_lock, false);
+  inode->data.index = true;
+  set_dirty(inode);
+  rw_lock_release(&inode->rw_lock, false);
+}
+
+/* Shrinks INODE to LENGTH bytes, if it is longer, releasing the
+   sectors past the new end and any reserved for growth. */
+void inode_truncate(struct inode* inode, off_t length) {
+  rw_lock_acquire(&inode->rw_lock, false);
+  if (length < inode->data.length) {
+    inode_resize(&inode->data, length);
+    set_dirty(inode);
+    map_invalidate(inode);
+    release_prealloc(&inode->prealloc);
+    inode->prealloc.extra = 0;
+  }
+  rw_lock_release(&inode->rw_lock, false);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -2,43 +2,102 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
-#include <list.h>
+#include <hash.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
+#include "threads/synch.h"
 
 #define NUM_DIRECT 100
 
+/* Number of extents stored in the inode itself. */
+#define INODE_EXTENTS 50
+
+/* Ways an inode can map its data sectors, chosen when the file
+   system is formatted. */
+enum inode_format {
+  INODE_INDEXED, /* Direct, indirect and doubly indirect pointers. */
+  INODE_EXTENT   /* Runs of consecutive sectors. */
+};
+
+/* LENGTH consecutive sectors starting at START. */
+struct extent {
+  block_sector_t start;
+  uint32_t length;
+};
+
+/* Free sectors set aside for an open inode to grow into. */
+struct prealloc {
+  block_sector_t start; /* First reserved sector, or where to look if none. */
+  size_t cnt;           /* Number of reserved sectors. */
+  size_t extra;         /* Sectors to reserve beyond the next growth. */
+};
+
 struct bitmap;
+struct buffer_cache_entry;
+struct extent_run;
 struct inode_disk {
-  block_sector_t direct[NUM_DIRECT]; /* First data sector. */
-  block_sector_t indirect;
-  block_sector_t double_indirect;
+  union {
+    struct {                             /* INODE_INDEXED. */
+      block_sector_t direct[NUM_DIRECT]; /* First data sector. */
+      block_sector_t indirect;
+      block_sector_t double_indirect;
+    };
+    struct {                                /* INODE_EXTENT. */
+      struct extent extents[INODE_EXTENTS]; /* First extents, in file order. */
+      block_sector_t extent_index;          /* Block of extent leaf sectors, or 0. */
+      uint32_t extent_cnt;                  /* Number of extents. */
+    };
+  };
   off_t length;   /* File size in bytes. */
   unsigned magic; /* Magic number. */
   bool dir;
-  char a;
-  char b;
+  uint8_t format; /* An enum inode_format. */
+  bool index;     /* A directory's hash index? */
   char c;
-  uint32_t unused[23]; /* Not used. */
+  block_sector_t dir_index; /* Inode of a directory's hash index, or 0. */
+  uint32_t unused[22];      /* Not used. */
 };
 struct inode {
-  struct list_elem elem;  /* Element in inode list. */
-  block_sector_t sector;  /* Sector number of disk location. */
-  int open_cnt;           /* Number of openers. */
-  bool removed;           /* True if deleted, false otherwise. */
-  int deny_write_cnt;     /* 0: writes ok, >0: deny writes. */
-  struct inode_disk data; /* Inode content. */
+  struct hash_elem elem;   /* Element in open inode table. */
+  block_sector_t sector;   /* Sector number of disk location. */
+  int open_cnt;            /* Number of openers. */
+  bool loaded;             /* DATA read from disk yet? */
+  bool removed;            /* True if deleted, false otherwise. */
+  int deny_write_cnt;      /* 0: writes ok, >0: deny writes. */
+  struct inode_disk data;  /* Inode content. */
+  bool dirty;              /* DATA changed since written to disk? */
+  struct rw_lock rw_lock;  /* Guards data and deny_write_cnt. */
+  struct rw_lock dir_lock; /* Guards directory entries and index. */
+  off_t dir_free;          /* Directory: no free slot before this offset. */
+  size_t dir_freed;        /* Directory: slots freed since last compacted. */
+  struct lock map_lock;    /* Protects map and runs. */
+  block_sector_t** map;    /* Cached indirect blocks, or null. */
+  struct extent_run* runs; /* Cached extents, or null. */
+  struct prealloc prealloc; /* Sectors reserved for growth. */
+  struct list_elem flush_elem; /* Element in inode_flush_all()'s list. */
 };
 
 void inode_init(void);
-bool inode_create(block_sector_t, off_t);
+void inode_set_format(enum inode_format);
+enum inode_format inode_get_format(const struct inode*);
+bool inode_create(block_sector_t, off_t, bool dir);
 struct inode* inode_open(block_sector_t);
 struct inode* inode_reopen(struct inode*);
 block_sector_t inode_get_inumber(const struct inode*);
 void inode_close(struct inode*);
+void inode_flush_all(void);
 void inode_remove(struct inode*);
+void inode_lock_dir(struct inode*, bool reader);
+void inode_unlock_dir(struct inode*, bool reader);
+block_sector_t inode_get_index(struct inode*);
+void inode_set_index(struct inode*, block_sector_t);
+void inode_mark_index(struct inode*);
+void inode_truncate(struct inode*, off_t length);
 off_t inode_read_at(struct inode*, void*, off_t size, off_t offset);
 off_t inode_write_at(struct inode*, const void*, off_t size, off_t offset);
+void inode_readahead(struct inode*, off_t offset, off_t size);
+struct buffer_cache_entry* inode_get_block(struct inode*, off_t pos, bool exclusive,
+                                           block_sector_t* sectorp);
 void inode_deny_write(struct inode*);
 void inode_allow_write(struct inode*);
 off_t inode_length(const struct inode*);
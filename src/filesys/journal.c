@@ -0,0 +1,689 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Metadata journal.
+
+   Inodes, indirect blocks, extent leaves, directories, their
+   hash indexes and the free map are metadata.  The buffer cache
+   never writes a metadata sector back in place.  Instead it hands
+   each new version of the sector to journal_log(), which keeps a
+   copy in memory as part of the running transaction.
+
+   File system operations run between journal_begin() and
+   journal_end().  A commit waits until none is in progress, so
+   the running transaction holds only whole operations.  It then
+   writes the transaction to the log with one sequential write: a
+   descriptor sector listing the home sectors of the blocks that
+   follow, repeated as needed, and a commit record holding a
+   checksum of all of them.  Every operation since the last
+   commit shares that write.  The flusher commits once per flush
+   interval.
+
+   Each operation may log at most JOURNAL_OP_BLOCKS blocks, plus
+   the inodes it changes and the free map.  journal_begin() lets
+   an operation start only if that much still fits in the log
+   along with the running transaction and the other operations in
+   progress, and otherwise waits for them or commits first.  So a
+   transaction always fits in the log, and no metadata is ever
+   written home before it is committed.
+
+   Committed blocks stay in memory until a checkpoint writes them
+   all to their home sectors and empties the log, once the log is
+   half full.  Until then a block read from disk into the buffer
+   cache is patched with the journal's copy by journal_overlay().
+
+   A commit keeps new operations out only while it gathers the
+   transaction.  It then freezes the transaction's blocks, and
+   those to be checkpointed, and writes them without holding
+   JOURNAL_LOCK.  A frozen block's data does not change: a new
+   version of its sector goes into a new block that takes its
+   place.  Writes and cache misses on sectors that are not
+   journaled at all check the JOURNALED bitmap and do not take
+   JOURNAL_LOCK.
+
+   At mount, journal_open() replays every transaction in the log
+   whose commit record is intact, in order, and empties the log.
+   The log header, in JOURNAL_SECTOR, is written only when the log
+   is emptied.  It records the sequence number the next
+   transaction gets, so that the transactions left over from
+   before are not replayed again.
+
+   File data is not journaled, except that a sector whose latest
+   version is in the journal stays there until the next
+   checkpoint even once it holds file data.  Otherwise a replay
+   could overwrite it with an older metadata version.  Nor may a
+   freed sector hold file data before the transaction that freed
+   it is committed, or a crash could bring back metadata pointing
+   to it, so the free map allocates it again only once the commit
+   calls free_map_reclaim().  A checkpoint holds off the buffer
+   cache's flush passes, which write without holding sector locks
+   and might otherwise put a freed sector's old contents over the
+   metadata it was reused for. */
+
+/* Magic numbers identifying journal sectors. */
+#define HEADER_MAGIC 0x4a524e4c /* Log header. */
+#define DESC_MAGIC 0x4a445343   /* Descriptor. */
+#define COMMIT_MAGIC 0x4a434d54 /* Commit record. */
+
+/* Size of the log in sectors. */
+#define LOG_SECTORS 256
+
+/* Number of home sectors a descriptor lists. */
+#define DESC_SECTORS 125
+
+/* Sectors written through the staging buffer with one request. */
+#define STAGE_PAGES 8
+#define STAGE_SECTORS (STAGE_PAGES * PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Log header, in JOURNAL_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header {
+  uint32_t magic;       /* HEADER_MAGIC. */
+  block_sector_t start; /* First sector of the log. */
+  uint32_t size;        /* Number of sectors in the log. */
+  uint32_t seq;         /* Sequence number of the first transaction. */
+  uint32_t unused[124]; /* Not used. */
+};
+
+/* Descriptor, followed in the log by the blocks it lists.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_desc {
+  uint32_t magic;                       /* DESC_MAGIC. */
+  uint32_t seq;                         /* Sequence number of the transaction. */
+  uint32_t cnt;                         /* Number of blocks that follow. */
+  block_sector_t sectors[DESC_SECTORS]; /* Home sector of each block. */
+};
+
+/* Commit record, which ends a transaction.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_commit {
+  uint32_t magic;       /* COMMIT_MAGIC. */
+  uint32_t seq;         /* Sequence number of the transaction. */
+  uint32_t sum;         /* Checksum of the transaction's other sectors. */
+  uint32_t unused[125]; /* Not used. */
+};
+
+/* A version of a journaled sector. */
+struct jblock {
+  block_sector_t sector;      /* Home sector. */
+  bool running;               /* Changed since the last commit? */
+  bool frozen;                /* Being written by a commit? */
+  uint8_t* data;              /* BLOCK_SECTOR_SIZE bytes of data. */
+  struct hash_elem hash_elem; /* Element in blocks, if the latest version. */
+  struct list_elem elem;      /* Element in running, committed or frozen. */
+};
+
+static bool active;              /* Journaling? */
+static block_sector_t start;     /* First sector of the log. */
+static size_t size;              /* Number of sectors in the log. */
+static size_t head;              /* Log sectors taken by committed transactions. */
+static size_t free_map_sectors;  /* Number of sectors in the free map file. */
+static struct hash blocks;       /* Latest version of each journaled sector. */
+static struct list running;      /* Blocks in the running transaction. */
+static struct list committed;    /* Blocks committed and not changed since. */
+static size_t running_cnt;       /* Number of blocks in RUNNING. */
+static size_t deferred;          /* Inodes changed since the last commit. */
+static int updates;              /* Operations in progress. */
+static bool blocking;            /* Is a commit waiting for operations to end? */
+static struct lock journal_lock; /* Protects the variables above. */
+static struct condition ended;     /* Broadcast when an operation ends. */
+static struct condition unblocked; /* Broadcast when BLOCKING is cleared. */
+static struct condition thawed;    /* Broadcast when frozen blocks are released. */
+
+/* Changed only with JOURNAL_LOCK held, but read without it by the
+   fast paths of journal_log() and journal_overlay(). */
+static struct bitmap* journaled; /* Sectors with a block in BLOCKS. */
+static unsigned epoch;           /* Number of checkpoints so far. */
+
+/* Owned by the thread holding COMMIT_LOCK. */
+static struct lock commit_lock; /* Serializes commits. */
+static uint32_t seq;            /* Sequence number of the next transaction. */
+static struct list frozen;      /* Blocks being written by the commit. */
+
+/* Staging buffer through which sectors are written in runs.
+   Owned by the thread holding COMMIT_LOCK. */
+static uint8_t* stage;
+static block_sector_t stage_start; /* First sector of the run in STAGE. */
+static size_t stage_cnt;           /* Number of sectors in STAGE. */
+
+static unsigned jblock_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_int(hash_entry(e, struct jblock, hash_elem)->sector);
+}
+
+static bool jblock_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  return hash_entry(a, struct jblock, hash_elem)->sector <
+         hash_entry(b, struct jblock, hash_elem)->sector;
+}
+
+/* Orders blocks on a list by ascending home sector. */
+static bool sector_less(const struct list_elem* a, const struct list_elem* b, void* aux UNUSED) {
+  return list_entry(a, struct jblock, elem)->sector < list_entry(b, struct jblock, elem)->sector;
+}
+
+/* Returns the latest block for SECTOR, or a null pointer if
+   SECTOR is not journaled.  JOURNAL_LOCK must be held. */
+static struct jblock* find_jblock(block_sector_t sector) {
+  struct jblock key;
+  struct hash_elem* e;
+
+  key.sector = sector;
+  e = hash_find(&blocks, &key.hash_elem);
+  return e != NULL ? hash_entry(e, struct jblock, hash_elem) : NULL;
+}
+
+/* Returns a new block for SECTOR, on COMMITTED, which becomes
+   SECTOR's latest version in place of any older one.  Returns a
+   null pointer if memory is short.  JOURNAL_LOCK must be held. */
+static struct jblock* new_jblock(block_sector_t sector) {
+  struct jblock* b = malloc(sizeof *b);
+
+  if (b == NULL || (b->data = malloc(BLOCK_SECTOR_SIZE)) == NULL) {
+    free(b);
+    return NULL;
+  }
+  b->sector = sector;
+  b->running = false;
+  b->frozen = false;
+  hash_replace(&blocks, &b->hash_elem);
+  list_push_back(&committed, &b->elem);
+  bitmap_mark(journaled, sector);
+  return b;
+}
+
+/* Frees block B. */
+static void free_jblock(struct jblock* b) {
+  free(b->data);
+  free(b);
+}
+
+/* Adds sector BUF to checksum SUM, returning the new sum. */
+static uint32_t checksum(uint32_t sum, const void* buf_) {
+  const uint8_t* buf = buf_;
+
+  for (size_t i = 0; i < BLOCK_SECTOR_SIZE; i++)
+    sum = (sum ^ buf[i]) * 16777619u;
+  return sum;
+}
+
+/* Initial value of a checksum. */
+#define SUM_BASIS 2166136261u
+
+/* Returns the number of log sectors a transaction of CNT blocks
+   takes. */
+static size_t txn_sectors(size_t cnt) { return DIV_ROUND_UP(cnt, DESC_SECTORS) + cnt + 1; }
+
+/* Returns true if the running transaction, with the inodes and
+   free map sectors the next commit adds to it, still fits in the
+   log if OPS operations each log JOURNAL_OP_BLOCKS more blocks.
+   JOURNAL_LOCK must be held. */
+static bool fits(int ops) {
+  size_t cnt = running_cnt + deferred + free_map_sectors + ops * JOURNAL_OP_BLOCKS;
+  return txn_sectors(cnt) <= size - head;
+}
+
+/* Writes out the run gathered in the staging buffer, if any. */
+static void stage_flush(void) {
+  if (stage_cnt > 0) {
+    block_write_multiple(fs_device, stage_start, stage_cnt, stage);
+    stage_cnt = 0;
+  }
+}
+
+/* Returns the staging buffer slot for SECTOR, writing out the run
+   gathered so far first if SECTOR does not extend it. */
+static void* stage_sector(block_sector_t sector) {
+  if (stage_cnt > 0 && (sector != stage_start + stage_cnt || stage_cnt == STAGE_SECTORS))
+    stage_flush();
+  if (stage_cnt == 0)
+    stage_start = sector;
+  return stage + stage_cnt++ * BLOCK_SECTOR_SIZE;
+}
+
+/* Writes the log header. */
+static void write_header(void) {
+  struct journal_header* h = stage_sector(JOURNAL_SECTOR);
+
+  memset(h, 0, sizeof *h);
+  h->magic = HEADER_MAGIC;
+  h->start = start;
+  h->size = size;
+  h->seq = seq;
+  stage_flush();
+}
+
+/* Moves the blocks on LIST to FROZEN.  JOURNAL_LOCK must be
+   held. */
+static void freeze(struct list* list) {
+  while (!list_empty(list)) {
+    struct jblock* b = list_entry(list_pop_front(list), struct jblock, elem);
+    b->running = false;
+    b->frozen = true;
+    list_push_back(&frozen, &b->elem);
+  }
+}
+
+/* Writes the first CNT frozen blocks to the log as a transaction
+   starting at offset POS. */
+static void write_txn(size_t pos, size_t cnt) {
+  struct list_elem* e = list_begin(&frozen);
+  uint32_t sum = SUM_BASIS;
+  struct journal_commit* c;
+
+  pos += start;
+  while (cnt > 0) {
+    struct journal_desc* d = stage_sector(pos++);
+    struct list_elem* last;
+
+    memset(d, 0, sizeof *d);
+    d->magic = DESC_MAGIC;
+    d->seq = seq;
+    for (last = e; d->cnt < cnt && d->cnt < DESC_SECTORS; last = list_next(last))
+      d->sectors[d->cnt++] = list_entry(last, struct jblock, elem)->sector;
+    sum = checksum(sum, d);
+    cnt -= d->cnt;
+
+    for (; e != last; e = list_next(e)) {
+      struct jblock* b = list_entry(e, struct jblock, elem);
+      memcpy(stage_sector(pos++), b->data, BLOCK_SECTOR_SIZE);
+      sum = checksum(sum, b->data);
+    }
+  }
+
+  c = stage_sector(pos++);
+  memset(c, 0, sizeof *c);
+  c->magic = COMMIT_MAGIC;
+  c->seq = seq;
+  c->sum = sum;
+  stage_flush();
+  seq++;
+}
+
+/* Releases the frozen blocks, once their commit is in the log.
+   Those still the latest version of their sector stay journaled
+   as committed blocks. */
+static void thaw(void) {
+  lock_acquire(&journal_lock);
+  while (!list_empty(&frozen)) {
+    struct jblock* b = list_entry(list_pop_front(&frozen), struct jblock, elem);
+    b->frozen = false;
+    if (find_jblock(b->sector) == b)
+      list_push_back(&committed, &b->elem);
+    else
+      free_jblock(b);
+  }
+  cond_broadcast(&thawed, &journal_lock);
+  lock_release(&journal_lock);
+}
+
+/* Writes the frozen blocks, which are every committed block, to
+   their home sectors in sector order, empties the log, and stops
+   journaling the sectors not changed again meanwhile. */
+static void checkpoint(void) {
+  list_sort(&frozen, sector_less, NULL);
+  for (struct list_elem* e = list_begin(&frozen); e != list_end(&frozen); e = list_next(e)) {
+    struct jblock* b = list_entry(e, struct jblock, elem);
+    memcpy(stage_sector(b->sector), b->data, BLOCK_SECTOR_SIZE);
+  }
+  stage_flush();
+  write_header();
+
+  /* A cache miss that read a home sector before it was written
+     must not find the block gone without also finding the epoch
+     changed, so the epoch changes first. */
+  lock_acquire(&journal_lock);
+  epoch++;
+  barrier();
+  while (!list_empty(&frozen)) {
+    struct jblock* b = list_entry(list_pop_front(&frozen), struct jblock, elem);
+    if (find_jblock(b->sector) == b) {
+      hash_delete(&blocks, &b->hash_elem);
+      bitmap_reset(journaled, b->sector);
+    }
+    free_jblock(b);
+  }
+  cond_broadcast(&thawed, &journal_lock);
+  lock_release(&journal_lock);
+}
+
+/* Walks the transaction numbered SEQ_ that starts at offset POS in
+   the log, writing its blocks to their home sectors if APPLY.
+   Returns true and sets *ENDP to the offset just past it if its
+   commit record is intact, otherwise returns false. */
+static bool replay_txn(size_t pos, uint32_t seq_, size_t* endp, bool apply) {
+  struct journal_desc* d = malloc(sizeof *d);
+  uint8_t* buf = malloc(BLOCK_SECTOR_SIZE);
+  uint32_t sum = SUM_BASIS;
+  bool intact = false;
+
+  if (d == NULL || buf == NULL)
+    PANIC("can't allocate journal replay buffers");
+
+  while (pos < size) {
+    block_read(fs_device, start + pos++, d);
+    if (d->magic == DESC_MAGIC && d->seq == seq_ && d->cnt > 0 && d->cnt <= DESC_SECTORS &&
+        pos + d->cnt < size) {
+      sum = checksum(sum, d);
+      for (size_t i = 0; i < d->cnt; i++) {
+        block_read(fs_device, start + pos++, buf);
+        sum = checksum(sum, buf);
+        if (apply)
+          block_write(fs_device, d->sectors[i], buf);
+      }
+    } else {
+      struct journal_commit* c = (struct journal_commit*)d;
+      intact = c->magic == COMMIT_MAGIC && c->seq == seq_ && c->sum == sum && sum != SUM_BASIS;
+      break;
+    }
+  }
+  *endp = pos;
+  free(buf);
+  free(d);
+  return intact;
+}
+
+/* Initializes the journal, which stays inactive until
+   journal_open(). */
+void journal_init(void) {
+  ASSERT(sizeof(struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT(sizeof(struct journal_desc) == BLOCK_SECTOR_SIZE);
+  ASSERT(sizeof(struct journal_commit) == BLOCK_SECTOR_SIZE);
+
+  if (!hash_init(&blocks, jblock_hash, jblock_less, NULL))
+    PANIC("journal index creation failed");
+  journaled = bitmap_create(block_size(fs_device));
+  if (journaled == NULL)
+    PANIC("journal bitmap creation failed");
+  list_init(&running);
+  list_init(&committed);
+  list_init(&frozen);
+  lock_init(&journal_lock);
+  cond_init(&ended);
+  cond_init(&unblocked);
+  cond_init(&thawed);
+  lock_init(&commit_lock);
+  stage = palloc_get_multiple(0, STAGE_PAGES);
+  if (stage == NULL)
+    PANIC("journal staging buffer allocation failed");
+}
+
+/* Creates an empty log on a newly formatted disk. */
+void journal_create(void) {
+  size = LOG_SECTORS;
+  if (!free_map_allocate_near(size, JOURNAL_SECTOR, &start))
+    PANIC("journal creation failed");
+
+  /* Whatever the log's first sector held before must not pass
+     for a transaction. */
+  memset(stage_sector(start), 0, BLOCK_SECTOR_SIZE);
+  stage_flush();
+
+  seq = 0;
+  write_header();
+}
+
+/* Replays the log's committed transactions, empties it, and
+   starts journaling. */
+void journal_open(void) {
+  struct journal_header* h = malloc(sizeof *h);
+  size_t pos, end;
+  int cnt = 0;
+
+  if (h == NULL)
+    PANIC("can't allocate journal header");
+  block_read(fs_device, JOURNAL_SECTOR, h);
+  if (h->magic != HEADER_MAGIC)
+    PANIC("no journal found--reformat the file system");
+  start = h->start;
+  size = h->size;
+  seq = h->seq;
+  free(h);
+
+  /* The free map file has a bit per sector.  A single operation
+     with all it may log must fit in the half of the log that a
+     checkpoint leaves free. */
+  free_map_sectors = DIV_ROUND_UP(block_size(fs_device), BLOCK_SECTOR_SIZE * 8);
+  if (txn_sectors(JOURNAL_OP_BLOCKS + free_map_sectors) > size / 2)
+    PANIC("journal too small--reformat the file system");
+
+  for (pos = 0; replay_txn(pos, seq, &end, false); pos = end) {
+    replay_txn(pos, seq++, &end, true);
+    cnt++;
+  }
+  if (cnt > 0)
+    printf("Replayed %d journal transactions.\n", cnt);
+  write_header();
+
+  lock_acquire(&journal_lock);
+  head = 0;
+  active = true;
+  lock_release(&journal_lock);
+}
+
+/* Commits the running transaction.  If CLOSE is true, or the log
+   is half full, writes all journaled blocks home afterward.  If
+   CLOSE is true, also stops journaling. */
+static void commit(bool close) {
+  size_t pos = 0, cnt = 0;
+  bool holding, checkpointing = false;
+
+  lock_acquire(&commit_lock);
+
+  /* Wait for operations in progress, and keep new ones out.  If a
+     checkpoint may be due, keep flush passes from running across
+     it. */
+  lock_acquire(&journal_lock);
+  blocking = true;
+  while (updates > 0)
+    cond_wait(&ended, &journal_lock);
+  holding = close || head + txn_sectors(running_cnt + deferred + free_map_sectors) > size / 2;
+  lock_release(&journal_lock);
+  if (holding)
+    buffer_cache_hold_flushes();
+
+  /* Bring the metadata kept in memory into the transaction, along
+     with the sectors released by its operations. */
+  free_map_seal();
+  inode_flush_all();
+  free_map_flush();
+
+  /* Freeze the transaction, and every committed block too if a
+     checkpoint is due, then let operations run again while they
+     are written.  A checkpoint found due only now waits for the
+     next commit. */
+  lock_acquire(&journal_lock);
+  if (active) {
+    cnt = running_cnt;
+    if (cnt > 0) {
+      if (txn_sectors(cnt) > size - head)
+        PANIC("journal transaction of %zu blocks overflows the log", cnt);
+      pos = head;
+      head += txn_sectors(cnt);
+    }
+    freeze(&running);
+    running_cnt = 0;
+    if (holding && (close || head > size / 2)) {
+      freeze(&committed);
+      checkpointing = true;
+      head = 0;
+    }
+    if (close)
+      active = false;
+  }
+  deferred = 0;
+  blocking = false;
+  cond_broadcast(&unblocked, &journal_lock);
+  lock_release(&journal_lock);
+
+  if (cnt > 0)
+    write_txn(pos, cnt);
+  free_map_reclaim();
+  if (checkpointing)
+    checkpoint();
+  else
+    thaw();
+  if (holding)
+    buffer_cache_resume_flushes();
+
+  lock_release(&commit_lock);
+}
+
+/* Commits the running transaction, writing it to the log.  Before
+   the journal is opened, just brings changed inodes and free map
+   sectors into the buffer cache. */
+void journal_commit(void) { commit(false); }
+
+/* Commits the running transaction, writes everything journaled
+   home, and stops journaling, leaving an empty log. */
+void journal_close(void) { commit(true); }
+
+/* Starts a file system operation, whose changes to metadata are
+   committed all together or not at all.  Waits for a commit that
+   is gathering its transaction, and for room in the log, which
+   may mean committing first.  Operations may nest; only the
+   outermost one counts.  The outermost call must not be made
+   while holding any file system lock. */
+void journal_begin(void) {
+  struct thread* t = thread_current();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  lock_acquire(&journal_lock);
+  for (;;) {
+    if (blocking) {
+      cond_wait(&unblocked, &journal_lock);
+    } else if (!active || fits(updates + 1)) {
+      break;
+    } else if (updates > 0) {
+      cond_wait(&ended, &journal_lock);
+    } else {
+      lock_release(&journal_lock);
+      commit(false);
+      lock_acquire(&journal_lock);
+    }
+  }
+  updates++;
+  lock_release(&journal_lock);
+}
+
+/* Ends a file system operation started by journal_begin(). */
+void journal_end(void) {
+  struct thread* t = thread_current();
+
+  ASSERT(t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire(&journal_lock);
+  updates--;
+  cond_broadcast(&ended, &journal_lock);
+  lock_release(&journal_lock);
+}
+
+/* Notes that an inode has changed, so that the next commit brings
+   one more block into the running transaction. */
+void journal_defer(void) {
+  lock_acquire(&journal_lock);
+  deferred++;
+  lock_release(&journal_lock);
+}
+
+/* Records DATA as the new contents of SECTOR in the running
+   transaction, if SECTOR holds METADATA or is already journaled.
+   Returns true if so, in which case the caller must not write
+   SECTOR home; returns false if SECTOR is to be written back as
+   usual, which includes when the journal is not active or memory
+   is short.  The caller must hold SECTOR's buffer cache lock for
+   writing. */
+bool journal_log(block_sector_t sector, const void* data, bool metadata) {
+  struct jblock* b;
+  bool logged = false;
+
+  /* Only a metadata write, under the same cache lock as this one,
+     can start journaling SECTOR, so its bit cannot be set behind
+     our back. */
+  if (!metadata && !bitmap_test(journaled, sector))
+    return false;
+
+  lock_acquire(&journal_lock);
+  for (;;) {
+    b = find_jblock(sector);
+    if (b == NULL || !b->frozen)
+      break;
+
+    /* A commit is writing the latest version.  Put the new one in
+       a block of its own, or wait for the commit if that fails. */
+    if (active) {
+      struct jblock* copy = new_jblock(sector);
+      if (copy != NULL) {
+        b = copy;
+        break;
+      }
+    }
+    cond_wait(&thawed, &journal_lock);
+  }
+  if (active) {
+    if (b == NULL && metadata)
+      b = new_jblock(sector);
+    if (b != NULL) {
+      memcpy(b->data, data, BLOCK_SECTOR_SIZE);
+      if (!b->running) {
+        list_remove(&b->elem);
+        list_push_back(&running, &b->elem);
+        b->running = true;
+        running_cnt++;
+      }
+      logged = true;
+    }
+  }
+  lock_release(&journal_lock);
+  return logged;
+}
+
+/* Returns the number of checkpoints so far, for
+   journal_overlay(). */
+unsigned journal_epoch(void) {
+  barrier();
+  return epoch;
+}
+
+/* Replaces the CNT sectors starting at FIRST in DATA, just read
+   from disk, by the journal's versions of any of them.  Returns
+   false, leaving DATA to be read again, if a checkpoint has
+   written sectors home since journal_epoch() returned EPOCH_,
+   because the read may have missed their new contents.  The
+   caller must hold the buffer cache lock for the sectors. */
+bool journal_overlay(block_sector_t first, size_t cnt, void* data, unsigned epoch_) {
+  bool current;
+
+  /* A checkpoint changes the epoch before it clears any bit. */
+  if (!bitmap_contains(journaled, first, cnt, true)) {
+    barrier();
+    return epoch == epoch_;
+  }
+
+  lock_acquire(&journal_lock);
+  current = epoch == epoch_;
+  if (current)
+    for (size_t i = 0; i < cnt; i++) {
+      struct jblock* b = find_jblock(first + i);
+      if (b != NULL)
+        memcpy((uint8_t*)data + i * BLOCK_SECTOR_SIZE, b->data, BLOCK_SECTOR_SIZE);
+    }
+  lock_release(&journal_lock);
+  return current;
+}
@@ -0,0 +1,27 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Most blocks, besides the inodes it changes and the free map, that
+   one operation between journal_begin() and journal_end() may log.
+   Larger changes must be split into several operations. */
+#define JOURNAL_OP_BLOCKS 64
+
+void journal_init(void);
+void journal_create(void);
+void journal_open(void);
+void journal_close(void);
+
+void journal_begin(void);
+void journal_end(void);
+void journal_commit(void);
+void journal_defer(void);
+
+bool journal_log(block_sector_t, const void*, bool metadata);
+unsigned journal_epoch(void);
+bool journal_overlay(block_sector_t, size_t cnt, void*, unsigned epoch);
+
+#endif /* filesys/journal.h */
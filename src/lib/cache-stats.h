@@ -0,0 +1,22 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Buffer cache statistics, as returned by the SYS_CACHE_STATS
+   system call.  Counters cover the time since they were last
+   reset; DIRTY is a snapshot.
+
+   Metadata is inodes, indirect blocks, directories and the free
+   map; data is the contents of ordinary files. */
+struct cache_stats {
+  unsigned metadata_hits;   /* Metadata accesses found in the cache. */
+  unsigned metadata_misses; /* Metadata accesses that read the disk. */
+  unsigned data_hits;       /* File data accesses found in the cache. */
+  unsigned data_misses;     /* File data accesses that read the disk. */
+  unsigned evictions;       /* Blocks evicted to make room for others. */
+  unsigned writebacks;      /* Dirty sectors written back to disk. */
+  unsigned readahead_hits;  /* Blocks loaded by read-ahead and then used. */
+  unsigned lock_wait_ms;    /* Time spent waiting for cached sectors' locks. */
+  unsigned dirty;           /* Sectors currently dirty in the cache. */
+};
+
+#endif /* lib/cache-stats.h */
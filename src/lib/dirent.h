@@ -0,0 +1,19 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdbool.h>
+
+/* Most entries SYS_GETDENTS returns in one call. */
+#define GETDENTS_MAX 64
+
+/* One directory entry, as returned by the SYS_GETDENTS system
+   call, which fills an array of them with as many of a
+   directory's entries as fit, up to GETDENTS_MAX.  Like
+   readdir(), it never returns "." or "..". */
+struct dirent {
+  unsigned inumber; /* Inode number of the entry. */
+  bool is_dir;      /* Is the entry a directory? */
+  char name[15];    /* Null-terminated name, at most 14 characters. */
+};
+
+#endif /* lib/dirent.h */
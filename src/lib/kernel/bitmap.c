@@ -6,6 +6,7 @@
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
+#include "filesys/inode.h"
 #endif
 
 /* Element type.
@@ -284,6 +285,22 @@ bool bitmap_write(const struct bitmap* b, struct file* file) {
   off_t size = byte_cnt(b->bit_cnt);
   return file_write_at(file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B's file image that start at byte OFS
+   to the same place in FILE, stopping at the end of the image.
+   The bytes go straight to FILE's inode, not through
+   file_write_at(), so that the write is not a journal operation of
+   its own and can be made while a commit is gathering.
+   Returns true if successful, false otherwise. */
+bool bitmap_write_part(const struct bitmap* b, struct file* file, size_t ofs, size_t size) {
+  size_t file_size = byte_cnt(b->bit_cnt);
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return inode_write_at(file_get_inode(file), (const uint8_t*)b->bits + ofs, size, ofs) ==
+         (off_t)size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -46,7 +46,9 @@ enum {
   SYS_RESET_CACHE,
 
   SYS_READ_COUNT,
-  SYS_WRITE_COUNT
+  SYS_WRITE_COUNT,
+
+  SYS_GETDENTS /* Reads many directory entries. */
 };
 
 #endif /* lib/syscall-nr.h */
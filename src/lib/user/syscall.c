@@ -116,6 +116,10 @@ bool isdir(int fd) { return syscall1(SYS_ISDIR, fd); }
 
 int inumber(int fd) { return syscall1(SYS_INUMBER, fd); }
 
+int getdents(int fd, struct dirent* entries, unsigned cnt) {
+  return syscall3(SYS_GETDENTS, fd, entries, cnt);
+}
+
 double compute_e(int n) { return (double)syscall1f(SYS_COMPUTE_E, n); }
 
 tid_t sys_pthread_create(stub_fun sfun, pthread_fun tfun, const void* arg) {
@@ -159,7 +163,22 @@ void sema_up(sema_t* sema) {
 
 tid_t get_tid(void) { return syscall0(SYS_GET_TID); }
 
-int get_buffer_cache_hit_rate() { return syscall0(SYS_CACHE_STATS); }
+bool get_buffer_cache_stats(struct cache_stats* stats) {
+  return syscall1(SYS_CACHE_STATS, stats);
+}
+
+/* Returns the percentage of cache accesses, data and metadata,
+   that hit since the statistics were last reset. */
+int get_buffer_cache_hit_rate() {
+  struct cache_stats stats;
+  unsigned hits, total;
+
+  if (!get_buffer_cache_stats(&stats))
+    return 0;
+  hits = stats.metadata_hits + stats.data_hits;
+  total = hits + stats.metadata_misses + stats.data_misses;
+  return total > 0 ? hits * 100 / total : 0;
+}
 
 void reset_buffer_cache_stats() { return syscall0(SYS_RESET_CACHE_STATS); }
 
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <pthread.h>
+#include <cache-stats.h>
+#include <dirent.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -61,9 +63,13 @@ bool mkdir(const char* dir);
 bool readdir(int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir(int fd);
 int inumber(int fd);
+int getdents(int fd, struct dirent* entries, unsigned cnt);
 
+bool get_buffer_cache_stats(struct cache_stats*);
 int get_buffer_cache_hit_rate(void);
 void reset_buffer_cache_stats(void);
 void buffer_cache_reset(void);
+int get_read_count(void);
+int get_write_count(void);
 
 #endif /* lib/user/syscall.h */
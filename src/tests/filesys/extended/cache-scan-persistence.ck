@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"scan" => ["\0" x 49152],
+		"hot0" => ["a" x 512], "hot1" => ["b" x 512],
+		"hot2" => ["c" x 512], "hot3" => ["d" x 512]});
+pass;
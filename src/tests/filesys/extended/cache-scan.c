@@ -0,0 +1,85 @@
+/* Mixes a large sequential read with repeated reads of a few
+   small files and checks that, once they have proven to be
+   reused, the small files stay cached across the scan.  Run with
+   the scan-resistant "2q" replacement policy. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOT_FILES 4
+#define SCAN_SIZE (512 * 96) /* Half again the default cache size. */
+#define ROUNDS 3
+
+static char buf[512];
+static char hot[512];
+static const char* hot_names[HOT_FILES] = {"hot0", "hot1", "hot2", "hot3"};
+
+/* Fills HOT with the contents of hot file I. */
+static void fill_hot(int i) { memset(hot, 'a' + i, sizeof hot); }
+
+/* Reads every hot file once, checking its contents, and returns
+   the number of sectors read from disk while doing so. */
+static int read_hot_files(void) {
+  int start = get_read_count();
+  for (int i = 0; i < HOT_FILES; i++) {
+    int fd = open(hot_names[i]);
+    if (fd < 2)
+      fail("open \"%s\"", hot_names[i]);
+    if (read(fd, buf, sizeof buf) != sizeof buf)
+      fail("read \"%s\"", hot_names[i]);
+    close(fd);
+    fill_hot(i);
+    if (memcmp(buf, hot, sizeof buf))
+      fail("\"%s\" has the wrong contents", hot_names[i]);
+  }
+  return get_read_count() - start;
+}
+
+/* Reads the scan file from start to end. */
+static void scan(void) {
+  int fd = open("scan");
+  if (fd < 2)
+    fail("open \"scan\"");
+  for (int ofs = 0; ofs < SCAN_SIZE; ofs += sizeof buf)
+    if (read(fd, buf, sizeof buf) != sizeof buf)
+      fail("read \"scan\" at offset %d", ofs);
+  close(fd);
+}
+
+void test_main(void) {
+  int fd, hot_reads = 0;
+
+  CHECK(create("scan", 0), "create \"scan\"");
+  CHECK((fd = open("scan")) > 1, "open \"scan\"");
+  for (int ofs = 0; ofs < SCAN_SIZE; ofs += sizeof buf)
+    if (write(fd, buf, sizeof buf) != sizeof buf)
+      fail("write \"scan\" at offset %d", ofs);
+  close(fd);
+
+  /* Each hot file gets data of its own, so that reading it
+     touches a data sector and not just a hole. */
+  msg("create hot files");
+  for (int i = 0; i < HOT_FILES; i++) {
+    if (!create(hot_names[i], 0))
+      fail("create \"%s\"", hot_names[i]);
+    if ((fd = open(hot_names[i])) < 2)
+      fail("open \"%s\"", hot_names[i]);
+    fill_hot(i);
+    if (write(fd, hot, sizeof hot) != sizeof hot)
+      fail("write \"%s\"", hot_names[i]);
+    close(fd);
+  }
+
+  buffer_cache_reset();
+
+  msg("interleave hot reads with scans");
+  for (int round = 0; round < ROUNDS; round++) {
+    hot_reads = read_hot_files();
+    scan();
+  }
+  hot_reads = read_hot_files();
+
+  CHECK(hot_reads < HOT_FILES, "hot files survived the scan");
+}
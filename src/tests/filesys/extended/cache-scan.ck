@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-scan) begin
+(cache-scan) create "scan"
+(cache-scan) open "scan"
+(cache-scan) create hot files
+(cache-scan) interleave hot reads with scans
+(cache-scan) hot files survived the scan
+(cache-scan) end
+EOF
+pass;
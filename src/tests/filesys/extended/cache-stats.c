@@ -0,0 +1,38 @@
+/* Checks that the buffer cache statistics tell file data from
+   metadata and account for write-back. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[512 * 16];
+
+void test_main(void) {
+  struct cache_stats stats;
+  int fd;
+
+  CHECK(create("stats", sizeof buf), "create \"stats\"");
+  CHECK((fd = open("stats")) > 1, "open \"stats\"");
+  CHECK(write(fd, buf, sizeof buf) == (int)sizeof buf, "write \"stats\"");
+  close(fd);
+
+  buffer_cache_reset();
+  CHECK(get_buffer_cache_stats(&stats), "get stats after flush");
+  CHECK(stats.writebacks > 0, "dirty sectors were written back");
+  CHECK(stats.dirty == 0, "nothing left dirty");
+
+  reset_buffer_cache_stats();
+  CHECK((fd = open("stats")) > 1, "reopen \"stats\"");
+  CHECK(read(fd, buf, sizeof buf) == (int)sizeof buf, "read \"stats\" cold");
+  CHECK(get_buffer_cache_stats(&stats), "get stats after cold read");
+  CHECK(stats.metadata_hits + stats.metadata_misses > 0, "lookup counted as metadata");
+  CHECK(stats.data_misses > 0, "cold read missed");
+  CHECK(stats.writebacks == 0, "write-back count was reset");
+
+  reset_buffer_cache_stats();
+  seek(fd, 0);
+  CHECK(read(fd, buf, sizeof buf) == (int)sizeof buf, "read \"stats\" hot");
+  CHECK(get_buffer_cache_stats(&stats), "get stats after hot read");
+  CHECK(stats.data_hits > 0 && stats.data_misses == 0, "hot read hit");
+  close(fd);
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-stats) begin
+(cache-stats) create "stats"
+(cache-stats) open "stats"
+(cache-stats) write "stats"
+(cache-stats) get stats after flush
+(cache-stats) dirty sectors were written back
+(cache-stats) nothing left dirty
+(cache-stats) reopen "stats"
+(cache-stats) read "stats" cold
+(cache-stats) get stats after cold read
+(cache-stats) lookup counted as metadata
+(cache-stats) cold read missed
+(cache-stats) write-back count was reset
+(cache-stats) read "stats" hot
+(cache-stats) get stats after hot read
+(cache-stats) hot read hit
+(cache-stats) end
+EOF
+pass;
@@ -0,0 +1,83 @@
+/* Creates enough files in a directory for it to be given a hash
+   index, removes most of them from the front so that the
+   directory is compacted, and checks that the files that remain
+   are listed exactly once and can still be opened, that the
+   removed ones cannot, and that new files can be created. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 200
+#define KEEP_CNT 20
+
+void test_main(void) {
+  struct dirent entries[8];
+  bool seen[FILE_CNT];
+  char name[16];
+  int dir_fd, cnt, i;
+
+  CHECK(mkdir("d"), "mkdir \"d\"");
+
+  msg("create %d files in \"d\"", FILE_CNT);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++) {
+    snprintf(name, sizeof name, "d/f%d", i);
+    CHECK(create(name, 0), "create \"%s\"", name);
+  }
+  quiet = false;
+
+  msg("remove all but the last %d files", KEEP_CNT);
+  quiet = true;
+  for (i = 0; i < FILE_CNT - KEEP_CNT; i++) {
+    snprintf(name, sizeof name, "d/f%d", i);
+    CHECK(remove(name), "remove \"%s\"", name);
+  }
+  quiet = false;
+
+  CHECK((dir_fd = open("d")) > 1, "open \"d\"");
+  msg("list \"d\" with getdents");
+  memset(seen, 0, sizeof seen);
+  while ((cnt = getdents(dir_fd, entries, sizeof entries / sizeof *entries)) > 0)
+    for (i = 0; i < cnt; i++) {
+      int n = atoi(entries[i].name + 1);
+
+      snprintf(name, sizeof name, "f%d", n);
+      if (strcmp(entries[i].name, name) || n < FILE_CNT - KEEP_CNT || n >= FILE_CNT)
+        fail("unexpected entry \"%s\"", entries[i].name);
+      if (seen[n])
+        fail("\"%s\" listed twice", entries[i].name);
+      seen[n] = true;
+    }
+  for (i = FILE_CNT - KEEP_CNT; i < FILE_CNT; i++)
+    if (!seen[i])
+      fail("\"f%d\" not listed", i);
+  msg("close \"d\"");
+  close(dir_fd);
+
+  msg("check which files remain");
+  for (i = 0; i < FILE_CNT; i++) {
+    int fd;
+
+    snprintf(name, sizeof name, "d/f%d", i);
+    fd = open(name);
+    if (i < FILE_CNT - KEEP_CNT && fd != -1)
+      fail("\"%s\" was removed but can still be opened", name);
+    if (i >= FILE_CNT - KEEP_CNT) {
+      if (fd < 2)
+        fail("open \"%s\" failed", name);
+      close(fd);
+    }
+  }
+
+  msg("create %d of the removed files again", KEEP_CNT);
+  quiet = true;
+  for (i = 0; i < KEEP_CNT; i++) {
+    snprintf(name, sizeof name, "d/f%d", i);
+    CHECK(create(name, 0), "create \"%s\"", name);
+  }
+  quiet = false;
+}
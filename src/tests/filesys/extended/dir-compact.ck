@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-compact) begin
+(dir-compact) mkdir "d"
+(dir-compact) create 200 files in "d"
+(dir-compact) remove all but the last 20 files
+(dir-compact) open "d"
+(dir-compact) list "d" with getdents
+(dir-compact) close "d"
+(dir-compact) check which files remain
+(dir-compact) create 20 of the removed files again
+(dir-compact) end
+EOF
+pass;
@@ -0,0 +1,63 @@
+/* Fills a directory with files and one subdirectory, then lists
+   it with getdents() a few entries at a time and checks that
+   every entry comes back exactly once, with the right type and
+   inode number. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 40
+
+void test_main(void) {
+  struct dirent entries[7];
+  bool seen[FILE_CNT + 1];
+  char name[16];
+  int dir_fd, sub_fd, sub_inumber, cnt, i;
+
+  CHECK(mkdir("d"), "mkdir \"d\"");
+  CHECK(mkdir("d/sub"), "mkdir \"d/sub\"");
+  CHECK((sub_fd = open("d/sub")) > 1, "open \"d/sub\"");
+  sub_inumber = inumber(sub_fd);
+  close(sub_fd);
+
+  msg("create %d files in \"d\"", FILE_CNT);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++) {
+    snprintf(name, sizeof name, "d/f%d", i);
+    CHECK(create(name, 0), "create \"%s\"", name);
+  }
+  quiet = false;
+
+  CHECK((dir_fd = open("d")) > 1, "open \"d\"");
+  msg("list \"d\" with getdents");
+  memset(seen, 0, sizeof seen);
+  while ((cnt = getdents(dir_fd, entries, sizeof entries / sizeof *entries)) > 0)
+    for (i = 0; i < cnt; i++) {
+      struct dirent* d = &entries[i];
+      int n;
+
+      if (!strcmp(d->name, "sub")) {
+        if (!d->is_dir || (int)d->inumber != sub_inumber)
+          fail("\"sub\" listed with wrong type or inumber");
+        n = FILE_CNT;
+      } else {
+        n = atoi(d->name + 1);
+        snprintf(name, sizeof name, "f%d", n);
+        if (strcmp(d->name, name) || n < 0 || n >= FILE_CNT || d->is_dir)
+          fail("unexpected entry \"%s\"", d->name);
+      }
+      if (seen[n])
+        fail("\"%s\" listed twice", d->name);
+      seen[n] = true;
+    }
+  CHECK(cnt == 0, "getdents at end of directory returns 0");
+  for (i = 0; i <= FILE_CNT; i++)
+    if (!seen[i])
+      fail("entry %d not listed", i);
+  msg("close \"d\"");
+  close(dir_fd);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "d"
+(dir-getdents) mkdir "d/sub"
+(dir-getdents) open "d/sub"
+(dir-getdents) create 40 files in "d"
+(dir-getdents) open "d"
+(dir-getdents) list "d" with getdents
+(dir-getdents) getdents at end of directory returns 0
+(dir-getdents) close "d"
+(dir-getdents) end
+EOF
+pass;
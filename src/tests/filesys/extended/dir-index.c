@@ -0,0 +1,57 @@
+/* Creates enough files in a directory for it to be given a hash
+   index, removes every other one, and checks that the removed
+   names are gone, that the rest are still found, and that the
+   removed names can be created again. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 200
+
+void test_main(void) {
+  char name[16];
+  int i;
+
+  CHECK(mkdir("d"), "mkdir \"d\"");
+
+  msg("create %d files in \"d\"", FILE_CNT);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++) {
+    snprintf(name, sizeof name, "d/f%d", i);
+    CHECK(create(name, 0), "create \"%s\"", name);
+  }
+  quiet = false;
+
+  msg("remove every other file");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i += 2) {
+    snprintf(name, sizeof name, "d/f%d", i);
+    CHECK(remove(name), "remove \"%s\"", name);
+  }
+  quiet = false;
+
+  msg("check which files remain");
+  for (i = 0; i < FILE_CNT; i++) {
+    int fd;
+
+    snprintf(name, sizeof name, "d/f%d", i);
+    fd = open(name);
+    if (i % 2 == 0 && fd != -1)
+      fail("\"%s\" was removed but can still be opened", name);
+    if (i % 2 != 0) {
+      if (fd < 2)
+        fail("open \"%s\" failed", name);
+      close(fd);
+    }
+  }
+
+  msg("create the removed files again");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i += 2) {
+    snprintf(name, sizeof name, "d/f%d", i);
+    CHECK(create(name, 0), "create \"%s\"", name);
+  }
+  quiet = false;
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-index) begin
+(dir-index) mkdir "d"
+(dir-index) create 200 files in "d"
+(dir-index) remove every other file
+(dir-index) check which files remain
+(dir-index) create the removed files again
+(dir-index) end
+EOF
+pass;
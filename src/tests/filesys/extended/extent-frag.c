@@ -0,0 +1,44 @@
+/* Grows two files one sector at a time, alternating between
+   them, on a file system formatted with extent inodes.  Every
+   sector of each file ends up in an extent of its own, so the
+   extents overflow the inode into leaf blocks. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (512 * 160)
+static char buf_a[FILE_SIZE];
+static char buf_b[FILE_SIZE];
+
+void test_main(void) {
+  int fd_a, fd_b;
+
+  random_init(0);
+  random_bytes(buf_a, sizeof buf_a);
+  random_bytes(buf_b, sizeof buf_b);
+
+  CHECK(create("a", 0), "create \"a\"");
+  CHECK(create("b", 0), "create \"b\"");
+
+  CHECK((fd_a = open("a")) > 1, "open \"a\"");
+  CHECK((fd_b = open("b")) > 1, "open \"b\"");
+
+  msg("write \"a\" and \"b\" alternately");
+  for (size_t ofs = 0; ofs < FILE_SIZE; ofs += 512) {
+    if (write(fd_a, buf_a + ofs, 512) != 512)
+      fail("write 512 bytes at offset %zu in \"a\" failed", ofs);
+    if (write(fd_b, buf_b + ofs, 512) != 512)
+      fail("write 512 bytes at offset %zu in \"b\" failed", ofs);
+  }
+
+  msg("close \"a\"");
+  close(fd_a);
+
+  msg("close \"b\"");
+  close(fd_b);
+
+  check_file("a", buf_a, FILE_SIZE);
+  check_file("b", buf_b, FILE_SIZE);
+}
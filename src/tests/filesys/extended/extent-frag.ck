@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(extent-frag) begin
+(extent-frag) create "a"
+(extent-frag) create "b"
+(extent-frag) open "a"
+(extent-frag) open "b"
+(extent-frag) write "a" and "b" alternately
+(extent-frag) close "a"
+(extent-frag) close "b"
+(extent-frag) open "a" for verification
+(extent-frag) verified contents of "a"
+(extent-frag) close "a"
+(extent-frag) open "b" for verification
+(extent-frag) verified contents of "b"
+(extent-frag) close "b"
+(extent-frag) end
+EOF
+pass;
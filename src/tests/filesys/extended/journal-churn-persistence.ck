@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+for (my $i = 1; $i < 240; $i += 2) {
+    $fs->{'j'}{"f$i"} = ["f$i"];
+}
+check_archive ($fs);
+pass;
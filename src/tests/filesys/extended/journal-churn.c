@@ -0,0 +1,52 @@
+/* Creates, writes and removes enough files for the metadata
+   journal to commit and checkpoint many times, then checks that
+   the survivors still hold what was written to them.  The
+   persistence check verifies that the same tree is found after
+   the journal is replayed at the next mount. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 240
+
+void test_main(void) {
+  char name[16], buf[16];
+  int fd, i;
+
+  CHECK(mkdir("j"), "mkdir \"j\"");
+
+  msg("create and write %d files in \"j\"", FILE_CNT);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++) {
+    snprintf(name, sizeof name, "j/f%d", i);
+    CHECK(create(name, 0), "create \"%s\"", name);
+    CHECK((fd = open(name)) > 1, "open \"%s\"", name);
+    CHECK(write(fd, name + 2, strlen(name + 2)) == (int)strlen(name + 2), "write \"%s\"", name);
+    close(fd);
+  }
+  quiet = false;
+
+  msg("remove the even-numbered files");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i += 2) {
+    snprintf(name, sizeof name, "j/f%d", i);
+    CHECK(remove(name), "remove \"%s\"", name);
+  }
+  quiet = false;
+
+  msg("check the odd-numbered files");
+  for (i = 1; i < FILE_CNT; i += 2) {
+    size_t len;
+
+    snprintf(name, sizeof name, "j/f%d", i);
+    len = strlen(name + 2);
+    if ((fd = open(name)) < 2)
+      fail("open \"%s\" failed", name);
+    if (filesize(fd) != (int)len || read(fd, buf, len) != (int)len || memcmp(buf, name + 2, len))
+      fail("\"%s\" has the wrong contents", name);
+    close(fd);
+  }
+}
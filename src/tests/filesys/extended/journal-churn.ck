@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-churn) begin
+(journal-churn) mkdir "j"
+(journal-churn) create and write 240 files in "j"
+(journal-churn) remove the even-numbered files
+(journal-churn) check the odd-numbered files
+(journal-churn) end
+EOF
+pass;
@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($data) = "\0" x 2048;
+check_archive ({"a" => [$data], "b" => [$data]});
+pass;
@@ -0,0 +1,34 @@
+/* Allocates sectors, so that the free map is dirty, then waits
+   for the flusher to commit the journal, which writes the free
+   map, and allocates again.  Shutting down commits once more with
+   the free map dirty.  Either commit hanging shows up as a
+   timeout. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[512 * 4];
+
+void test_main(void) {
+  int fd, writes, i;
+
+  CHECK(create("a", 0), "create \"a\"");
+  CHECK((fd = open("a")) > 1, "open \"a\"");
+  CHECK(write(fd, buf, sizeof buf) == (int)sizeof buf, "write \"a\"");
+  close(fd);
+
+  /* The flush interval is one tick, so a flush comes long before
+     the loop runs out. */
+  writes = get_write_count();
+  for (i = 0; i < 1000000 && get_write_count() == writes; i++)
+    continue;
+  if (get_write_count() == writes)
+    fail("the flusher wrote nothing");
+  msg("the flusher wrote to disk");
+
+  CHECK(create("b", sizeof buf), "create \"b\"");
+  CHECK((fd = open("b")) > 1, "open \"b\"");
+  CHECK(write(fd, buf, sizeof buf) == (int)sizeof buf, "write \"b\"");
+  close(fd);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-flush) begin
+(journal-flush) create "a"
+(journal-flush) open "a"
+(journal-flush) write "a"
+(journal-flush) the flusher wrote to disk
+(journal-flush) create "b"
+(journal-flush) open "b"
+(journal-flush) write "b"
+(journal-flush) end
+EOF
+pass;
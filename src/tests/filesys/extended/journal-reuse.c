@@ -0,0 +1,54 @@
+/* Creates and removes enough files that their freed inode
+   sectors are still held by the metadata journal, waits for the
+   flusher to commit the removals, which lets the sectors be
+   allocated again, then writes them back as file data in a single
+   write() far larger than one journal transaction may hold.  The
+   persistence check verifies that the data survives the journal
+   replay at the next mount. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 200
+#define FILE_SIZE (512 * 240)
+static char buf[FILE_SIZE];
+
+void test_main(void) {
+  char name[16];
+  int fd, writes, i;
+
+  random_init(0);
+  random_bytes(buf, sizeof buf);
+
+  msg("create and remove %d files", FILE_CNT);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++) {
+    snprintf(name, sizeof name, "f%d", i);
+    CHECK(create(name, 0), "create \"%s\"", name);
+  }
+  for (i = 0; i < FILE_CNT; i++) {
+    snprintf(name, sizeof name, "f%d", i);
+    CHECK(remove(name), "remove \"%s\"", name);
+  }
+  quiet = false;
+
+  writes = get_write_count();
+  for (i = 0; i < 1000000 && get_write_count() == writes; i++)
+    continue;
+  if (get_write_count() == writes)
+    fail("the flusher wrote nothing");
+  msg("the flusher wrote to disk");
+
+  CHECK(create("data", 0), "create \"data\"");
+  CHECK((fd = open("data")) > 1, "open \"data\"");
+  msg("write \"data\"");
+  if (write(fd, buf, sizeof buf) != sizeof buf)
+    fail("write \"data\" failed");
+  msg("close \"data\"");
+  close(fd);
+
+  check_file("data", buf, sizeof buf);
+}
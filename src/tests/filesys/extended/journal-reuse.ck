@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-reuse) begin
+(journal-reuse) create and remove 200 files
+(journal-reuse) the flusher wrote to disk
+(journal-reuse) create "data"
+(journal-reuse) open "data"
+(journal-reuse) write "data"
+(journal-reuse) close "data"
+(journal-reuse) open "data" for verification
+(journal-reuse) verified contents of "data"
+(journal-reuse) close "data"
+(journal-reuse) end
+EOF
+pass;
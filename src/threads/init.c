@@ -236,10 +236,24 @@ static char** parse_options(char** argv) {
 #ifdef FILESYS
     else if (!strcmp(name, "-f"))
       format_filesys = true;
+    else if (!strcmp(name, "-inode-format")) {
+      if (!filesys_set_format(value))
+        PANIC("unknown inode format `%s' (use -h for help)", value);
+    }
     else if (!strcmp(name, "-filesys"))
       filesys_bdev_name = value;
     else if (!strcmp(name, "-scratch"))
       scratch_bdev_name = value;
+    else if (!strcmp(name, "-cache"))
+      buffer_cache_configure(atoi(value));
+    else if (!strcmp(name, "-cache-flush"))
+      buffer_cache_set_flush_interval(atoi(value));
+    else if (!strcmp(name, "-cache-dirty"))
+      buffer_cache_set_dirty_ratio(atoi(value));
+    else if (!strcmp(name, "-cache-policy")) {
+      if (!buffer_cache_set_policy(value))
+        PANIC("unknown cache policy `%s' (use -h for help)", value);
+    }
 #ifdef VM
     else if (!strcmp(name, "-swap"))
       swap_bdev_name = value;
@@ -418,8 +432,13 @@ static void usage(void) {
          "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
          "  -f                 Format file system device during startup.\n"
+         "  -inode-format=NAME Format with \"indexed\" or \"extent\" inodes.\n"
          "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
          "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+         "  -cache=SECTORS     Cache up to SECTORS disk sectors in memory.\n"
+         "  -cache-flush=MS    Write back dirty cached sectors every MS milliseconds.\n"
+         "  -cache-dirty=PCT   Write back early once PCT percent of the cache is dirty.\n"
+         "  -cache-policy=NAME Use cache replacement policy NAME (\"clock\" or \"2q\").\n"
 #ifdef VM
          "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif // VM
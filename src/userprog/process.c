@@ -12,6 +12,7 @@
 #include "filesys/file.h"
 #include "filesys/inode.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
@@ -274,11 +275,13 @@ void process_exit(void) {
     file_d = list_entry(e, struct file_descriptor, elem);
     old = e;
     e = list_next(e);
+    journal_begin();
     if (file_d->d) {
       dir_close(file_d->dir);
     } else {
       file_close(file_d->file);
     }
+    journal_end();
     list_remove(old);
     free(file_d);
   }
@@ -8,25 +8,29 @@
 #include "userprog/pagedir.h"
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include "threads/vaddr.h"
 
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/directory.h"
 #include "filesys/inode.h"
+#include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "lib/kernel/console.h"
 #include "devices/input.h"
 #include "lib/kernel/list.h"
 #include "threads/synch.h"
 
 #include "devices/block.h"
+#include <cache-stats.h>
+#include <dirent.h>
 
 void check_valid_fixed_size_ptr(void* ptr, size_t size, struct intr_frame* f);
+void check_valid_buffer(void* ptr, size_t size, struct intr_frame* f);
 void check_valid_string(char* str, struct intr_frame* f);
 bool is_valid_ptr(void* ptr);
 
-struct lock filelock;
-
 bool is_valid_ptr(void* ptr) {
   if (ptr == NULL)
     return false;
@@ -52,6 +56,14 @@ void check_valid_fixed_size_ptr(void* ptr, size_t size, struct intr_frame* f) {
   }
 }
 
+/* Like check_valid_fixed_size_ptr(), but checks every page of the
+   SIZE bytes at PTR, not just the first and last byte. */
+void check_valid_buffer(void* ptr, size_t size, struct intr_frame* f) {
+  check_valid_fixed_size_ptr(ptr, size, f);
+  for (char* page = pg_round_up(ptr); page < (char*)ptr + size; page += PGSIZE)
+    check_valid_fixed_size_ptr(page, 0, f);
+}
+
 void check_valid_string(char* str, struct intr_frame* f) {
   do {
     if (!is_valid_ptr(str)) {
@@ -114,47 +126,54 @@ static int get_next_part(char part[NAME_MAX + 1], const char** srcp) {
   return 1;
 }
 
-struct dir* find_dir(char* addr, struct dir* start) {
-  char temp[NAME_MAX + 1];
-  int res = get_next_part(temp, &addr);
-  struct dir* dir = dir_open_root();
-  if (start != NULL) {
-    dir->inode = inode_reopen(start->inode);
-  }
-  struct inode* i;
-  while (res != 0) {
-    if (!dir_lookup(dir, temp, &i)) {
+/* Opens and returns the directory named by the components of
+   PATH that begin before END, or by all of them if END is null.
+   They are looked up from the root if PATH is absolute or START
+   is null, otherwise from START.  Returns a null pointer if a
+   component is missing or too long. */
+static struct dir* walk_path(const char* path, const char* end, struct dir* start) {
+  char part[NAME_MAX + 1];
+  struct dir* dir = path[0] == '/' || start == NULL ? dir_open_root() : dir_reopen(start);
+
+  while (dir != NULL) {
+    struct inode* inode;
+
+    while (*path == '/')
+      path++;
+    if (*path == '\0' || (end != NULL && path >= end))
+      break;
+    if (get_next_part(part, &path) != 1 || !dir_lookup(dir, part, &inode)) {
+      dir_close(dir);
       return NULL;
     }
-    dir->inode = i;
-    res = get_next_part(temp, &addr);
+    dir_close(dir);
+    dir = dir_open(inode);
   }
   return dir;
 }
 
-void splitPath(const char* path, char** directory, char** filename) {
-  const char* lastSlash = strrchr(path, '/');
-
-  if (lastSlash != NULL) {
-    size_t dirLength = lastSlash - path;
-    size_t filenameLength = strlen(lastSlash + 1);
+/* Opens and returns the directory named by PATH, looked up as by
+   walk_path(). */
+struct dir* find_dir(const char* path, struct dir* start) { return walk_path(path, NULL, start); }
 
-    *directory = (char*)malloc((dirLength + 1) * sizeof(char));
-    *filename = (char*)malloc((filenameLength + 1) * sizeof(char));
+/* Opens and returns the directory that holds the last component
+   of PATH, looked up as by walk_path(), and stores the last
+   component in NAME.  NAME is empty if PATH ends in a slash.
+   Returns a null pointer if the directory is not found or the
+   last component is longer than NAME_MAX. */
+struct dir* find_parent(const char* path, struct dir* start, char name[NAME_MAX + 1]) {
+  const char* slash = strrchr(path, '/');
+  const char* last = slash != NULL ? slash + 1 : path;
 
-    strlcpy(*directory, path, dirLength + 1);
-    strlcpy(*filename, lastSlash + 1, filenameLength + 1);
-  } else {
-    *directory = NULL;
-    *filename = (char*)malloc((strlen(path) + 1) * sizeof(char));
-    strlcpy(*filename, path, strlen(path) + 1);
-  }
+  if (strlen(last) > NAME_MAX)
+    return NULL;
+  strlcpy(name, last, NAME_MAX + 1);
+  return walk_path(path, last, start);
 }
 
 static void syscall_handler(struct intr_frame*);
 
 void syscall_init(void) {
-  lock_init(&filelock);
   intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -187,9 +206,7 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
   } else if (args[0] == SYS_EXEC) {
     check_valid_fixed_size_ptr(args + sizeof(uint32_t), sizeof(char*), f);
     check_valid_string((char*)args[1], f);
-    lock_acquire(&filelock);
     f->eax = process_execute(args[1]);
-    lock_release(&filelock);
   } else if (args[0] == SYS_WAIT) {
     check_valid_fixed_size_ptr(args + sizeof(uint32_t), sizeof(int), f);
     f->eax = process_wait((pid_t)args[1]);
@@ -200,18 +217,14 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
     check_valid_fixed_size_ptr(&args[1], sizeof(char*), f);
     check_valid_string((char*)args[1], f);
     check_valid_fixed_size_ptr(&args[2], sizeof(unsigned), f);
-    lock_acquire(&filelock);
     bool res = filesys_create(args[1], args[2]);
     f->eax = res;
-    lock_release(&filelock);
   } else if (args[0] == SYS_OPEN) {
     check_valid_fixed_size_ptr(&args[1], sizeof(char*), f);
     check_valid_string((char*)args[1], f);
-    lock_acquire(&filelock);
     char* file_name = (char*)args[1];
     if (strcmp(file_name, "") == 0) {
       f->eax = -1;
-      lock_release(&filelock);
       return;
     }
     struct file* new_file = NULL;
@@ -220,34 +233,23 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
     struct file_descriptor* filed = malloc(sizeof(struct file_descriptor));
     struct inode* inode = NULL;
     char* path = (char*)args[1];
-    struct dir* addr;
-    char* dir;
-    char* new;
-    splitPath(path, &dir, &new);
-    if (path[0] == '/') {
-      addr = find_dir(dir, NULL);
-    } else {
-      addr = find_dir(dir, p->cwd);
-    }
-    if (strcmp(new, "") == 0) {
-      free(new);
-      free(dir);
+    char new[NAME_MAX + 1];
+    struct dir* addr = find_parent(path, p->cwd, new);
+    if (addr != NULL && new[0] == '\0') {
       filed->fd = p->next_fd;
       filed->file = new_file;
+      filed->d = true;
       addr->pos = 40;
       filed->dir = addr;
       p->next_fd += 1;
       list_push_back(&(p->file_descriptor_table), &(filed->elem));
       f->eax = filed->fd;
-      lock_release(&filelock);
       return;
     }
     if (addr == NULL || addr->inode->removed) {
       f->eax = -1;
       free(filed);
-      free(new);
-      free(dir);
-      lock_release(&filelock);
+      dir_close(addr);
       return;
     }
     dir_lookup(addr, new, &inode);
@@ -255,9 +257,6 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
     if (inode == NULL || inode->removed) {
       f->eax = -1;
       free(filed);
-      free(new);
-      free(dir);
-      lock_release(&filelock);
       return;
     }
     if (!inode->data.dir) {
@@ -266,9 +265,6 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
       if (new_file == NULL) {
         f->eax = -1;
         free(filed);
-        free(new);
-        free(dir);
-        lock_release(&filelock);
         return;
       }
     } else {
@@ -276,73 +272,51 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
       if (new_dir == NULL) {
         f->eax = -1;
         free(filed);
-        free(new);
-        free(dir);
-        lock_release(&filelock);
         return;
       }
       new_dir->pos = 40;
       filed->d = true;
     }
-    free(new);
-    free(dir);
     filed->fd = p->next_fd;
     filed->file = new_file;
     filed->dir = new_dir;
     p->next_fd += 1;
     list_push_back(&(p->file_descriptor_table), &(filed->elem));
     f->eax = filed->fd;
-    lock_release(&filelock);
   } else if (args[0] == SYS_REMOVE) {
     check_valid_fixed_size_ptr(&args[1], sizeof(char*), f);
     check_valid_string((char*)args[1], f);
-    lock_acquire(&filelock);
     bool res;
     char* path = args[1];
     struct process* p = thread_current()->pcb;
-    struct dir* addr;
-    char* dir;
-    char* new;
-    splitPath(path, &dir, &new);
-    if (path[0] == '/') {
-      addr = find_dir(dir, NULL);
-    } else {
-      addr = find_dir(dir, p->cwd);
-    }
-    if (addr->inode->removed) {
+    char new[NAME_MAX + 1];
+    struct dir* addr = find_parent(path, p->cwd, new);
+    if (addr == NULL || addr->inode->removed) {
       f->eax = false;
-      lock_release(&filelock);
-      free(new);
-      free(dir);
+      dir_close(addr);
       return;
     }
+    journal_begin();
     res = dir_remove(addr, new);
+    journal_end();
     dir_close(addr);
-    free(new);
-    free(dir);
     f->eax = res;
-    lock_release(&filelock);
   } else if (args[0] == SYS_FILESIZE) {
     check_valid_fixed_size_ptr(&args[1], sizeof(int), f);
-    lock_acquire(&filelock);
     struct process* p = thread_current()->pcb;
     struct file* file = find_file(p, args[1]);
     if (file == NULL) {
       f->eax = -1;
-      lock_release(&filelock);
       return;
     }
     f->eax = file_length(file);
-    lock_release(&filelock);
   } else if (args[0] == SYS_READ) {
     check_valid_fixed_size_ptr(&args[2], sizeof(char*), f); // validate pointer to buffer arg
     check_valid_string((char*)args[2], f);                  // validate buffer
     check_valid_fixed_size_ptr(&args[3], sizeof(unsigned), f);
     check_valid_fixed_size_ptr(&args[1], sizeof(int), f);
-    lock_acquire(&filelock);
     if (args[1] == STDIN_FILENO) {
       input_getc();
-      lock_release(&filelock);
       return;
     }
     //check_valid_string((char*)args[1], f);
@@ -350,21 +324,17 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
     struct file* file = find_file(p, args[1]);
     if (file == NULL) {
       f->eax = -1;
-      lock_release(&filelock);
       return;
     }
     f->eax = file_read(file, args[2], (off_t)args[3]);
-    lock_release(&filelock);
   } else if (args[0] == SYS_WRITE) {
     check_valid_fixed_size_ptr(&args[2], sizeof(char*), f); // validate pointer to buffer arg
     check_valid_string((char*)args[2], f);                  // validate buffer
     check_valid_fixed_size_ptr(&args[3], sizeof(unsigned), f);
     check_valid_fixed_size_ptr(&args[1], sizeof(int), f);
-    lock_acquire(&filelock);
     if (args[1] == STDOUT_FILENO) {
       f->eax = args[3];
       putbuf(args[2], args[3]);
-      lock_release(&filelock);
       return;
     }
     //
@@ -373,44 +343,36 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
     if (file == NULL) {
       struct process* pcb = thread_current()->pcb;
       pcb->exit_status = -1;
-      lock_release(&filelock);
       f->eax = -1;
       process_exit();
       return;
     }
     f->eax = file_write(file, args[2], (off_t)args[3]);
-    lock_release(&filelock);
   } else if (args[0] == SYS_SEEK) {
     check_valid_fixed_size_ptr(&args[2], sizeof(unsigned), f);
     check_valid_fixed_size_ptr(&args[1], sizeof(int), f);
-    lock_acquire(&filelock);
     struct process* p = thread_current()->pcb;
     struct file* file = find_file(p, args[1]);
     if (file == NULL) {
       struct process* pcb = thread_current()->pcb;
       pcb->exit_status = -1;
-      lock_release(&filelock);
       f->eax = -1;
       process_exit();
       return;
     }
     file_seek(file, (off_t)args[2]);
-    lock_release(&filelock);
   } else if (args[0] == SYS_TELL) {
     check_valid_fixed_size_ptr(&args[1], sizeof(int), f);
-    lock_acquire(&filelock);
     struct process* p = thread_current()->pcb;
     struct file* file = find_file(p, args[1]);
     if (file == NULL) {
       struct process* pcb = thread_current()->pcb;
       pcb->exit_status = -1;
-      lock_release(&filelock);
       f->eax = -1;
       process_exit();
       return;
     }
     f->eax = file_tell(file);
-    lock_release(&filelock);
   } else if (args[0] == SYS_CLOSE) {
     int fd = args[1];
     if (fd < 3) {
@@ -424,11 +386,13 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
       file_d = list_entry(e, struct file_descriptor, elem);
 
       if (file_d->fd == fd) {
+        journal_begin();
         if (file_d->d) {
           dir_close(file_d->dir);
         } else {
           file_close(file_d->file);
         }
+        journal_end();
         list_remove(e);
 
         return;
@@ -449,36 +413,32 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
 
     char* path = args[1];
     struct process* p = thread_current()->pcb;
-    struct dir* addr;
-    char* dir;
-    char* new;
-    splitPath(path, &dir, &new);
-    if (path[0] == '/') {
-      addr = find_dir(dir, NULL);
-    } else {
-      addr = find_dir(dir, p->cwd);
-    }
-    struct inode* i;
+    char new[NAME_MAX + 1];
+    journal_begin();
+    struct dir* addr = find_parent(path, p->cwd, new);
+    struct inode* i = NULL;
     if (addr == NULL || addr->inode->removed || dir_lookup(addr, new, &i)) {
       f->eax = false;
+      inode_close(i);
+      dir_close(addr);
+      journal_end();
       return;
     }
     block_sector_t bt;
-    if (!free_map_allocate(1, &bt)) {
+    if (!free_map_allocate_inode(inode_get_inumber(addr->inode), true, &bt)) {
       f->eax = false;
-      free(new);
-      free(dir);
+      dir_close(addr);
+      journal_end();
       return;
     }
     if (!dir_create(bt, 10) || !dir_add(addr, new, bt)) {
       free_map_release(bt, 1);
       f->eax = false;
-      free(new);
-      free(dir);
+      dir_close(addr);
+      journal_end();
       return;
     }
     struct inode* inode = inode_open(bt);
-    inode->data.dir = true;
     struct dir* new_dir = malloc(sizeof(struct dir));
     new_dir->inode = inode;
     if (!dir_add(new_dir, ".", bt) || !dir_add(new_dir, "..", inode_get_inumber(addr->inode))) {
@@ -486,24 +446,19 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
     } else {
       f->eax = true;
     }
-    free(new_dir);
-    free(new);
-    free(dir);
+    dir_close(new_dir);
+    dir_close(addr);
+    journal_end();
     return;
   } else if (args[0] == SYS_CHDIR) {
     struct process* p = thread_current()->pcb;
-    struct dir* dir;
-    char* path = args[1];
-    if (path[0] == '/') {
-      dir = find_dir((char*)args[1], NULL);
-    } else {
-      dir = find_dir((char*)args[1], p->cwd);
-    }
+    struct dir* dir = find_dir((char*)args[1], p->cwd);
     if (dir == NULL) {
       f->eax = false;
       return;
     }
     f->eax = true;
+    dir_close(p->cwd);
     p->cwd = dir;
     return;
   } else if (args[0] == SYS_ISDIR) {
@@ -583,8 +538,34 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
     }
     f->eax = false;
     return;
+  } else if (args[0] == SYS_GETDENTS) {
+    check_valid_fixed_size_ptr(&args[1], 3 * sizeof(uint32_t), f);
+    int fd = args[1];
+    struct dirent* entries = (struct dirent*)args[2];
+    size_t cnt = args[3] < GETDENTS_MAX ? args[3] : GETDENTS_MAX;
+    if (cnt > 0)
+      check_valid_buffer(entries, cnt * sizeof *entries, f);
+    f->eax = -1;
+    struct list_elem* e;
+    struct file_descriptor* file_d;
+    struct process* p = thread_current()->pcb;
+    for (e = list_begin(&(p->file_descriptor_table)); e != list_end(&(p->file_descriptor_table));
+         e = list_next(e)) {
+      file_d = list_entry(e, struct file_descriptor, elem);
+      if (file_d->fd == fd) {
+        if (file_d->d)
+          f->eax = dir_getdents(file_d->dir, entries, cnt);
+        return;
+      }
+      if (file_d->fd > fd)
+        return;
+    }
+    return;
   } else if (args[0] == SYS_CACHE_STATS) {
-    f->eax = get_buffer_cache_hit_rate();
+    check_valid_fixed_size_ptr(&args[1], sizeof(struct cache_stats*), f);
+    check_valid_fixed_size_ptr((void*)args[1], sizeof(struct cache_stats), f);
+    buffer_cache_get_stats((struct cache_stats*)args[1]);
+    f->eax = true;
     return;
   } else if (args[0] == SYS_RESET_CACHE_STATS) {
     reset_buffer_cache_stats();
@@ -1,6 +1,10 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include "filesys/directory.h"
+
 void syscall_init(void);
+struct dir* find_dir(const char* path, struct dir* start);
+struct dir* find_parent(const char* path, struct dir* start, char name[NAME_MAX + 1]);
 
 #endif /* userprog/syscall.h */